@@ -2,9 +2,42 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <deque>
 #include <mutex>
 #include <sstream>
+#include <fstream>
+#include <memory>
+#include <tuple>
+#include <iomanip>
+#include <algorithm>
+#include <string_view>
+#include <cctype>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cassert>
+#include <condition_variable>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstddef>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 using namespace std;
 
 //------------------------------------------------------
@@ -35,271 +68,6094 @@ public:
 };
 
 //------------------------------------------------------
-// ParkingSpot Class
+// SpotList: spot numbers held by one vehicle, stored inline so passing a
+// location around never touches the heap. Vehicles needing more than
+// kMaxSpotsPerVehicle spots cannot be parked.
+const int kMaxSpotsPerVehicle = 4;
+
+struct SpotList {
+    int count;
+    int spots[kMaxSpotsPerVehicle];
+
+    SpotList() : count(0), spots() {}
+
+    void push_back(int spot) { spots[count++] = spot; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    int front() const { return spots[0]; }
+    int operator[](int i) const { return spots[i]; }
+    const int* begin() const { return spots; }
+    const int* end() const { return spots + count; }
+};
+
+//------------------------------------------------------
+// Dense vehicle IDs. Every license plate is mapped to a 32-bit ID once, when
+// the vehicle enters; all internal structures are keyed by that ID.
+typedef uint32_t VehicleId;
+const VehicleId kNoVehicle = 0;
+
+// FNV-1a hash of a license plate. Stable across runs, since snapshots store
+// tables built with it.
+inline uint64_t plateHash(string_view licensePlate) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : licensePlate)
+        hash = (hash ^ c) * 1099511628211ULL;
+    return hash;
+}
+
+// Plates with IDs 1..count kept outside the interner, read-only, e.g. in a
+// mapped snapshot. Plate i is pool[offsets[i - 1], offsets[i]), and `slots`
+// is an open-addressing table of IDs (0 = empty) keyed by plateHash().
+struct FrozenPlates {
+    const char* pool = nullptr;
+    const uint64_t* offsets = nullptr;  // count + 1 entries
+    const uint32_t* slots = nullptr;
+    uint64_t slotMask = 0;
+    uint32_t count = 0;
+
+    string_view plate(VehicleId id) const {
+        return string_view(pool + offsets[id - 1], offsets[id] - offsets[id - 1]);
+    }
+
+    // Probes at most every slot once, so even a table with no empty slot
+    // (which a valid snapshot never has) cannot loop forever.
+    VehicleId find(string_view licensePlate) const {
+        if (count == 0)
+            return kNoVehicle;
+        uint64_t i = plateHash(licensePlate) & slotMask;
+        for (uint64_t probes = 0; probes <= slotMask; ++probes, i = (i + 1) & slotMask) {
+            VehicleId id = slots[i];
+            if (id == kNoVehicle || plate(id) == licensePlate)
+                return id;
+        }
+        return kNoVehicle;
+    }
+};
+
+// ChunkedArray: array indexed by a dense ID that grows one fixed-size chunk at
+// a time. Chunks never move, so readers index it without a lock while writers
+// fill new elements. A writer must publish an element (e.g. through an atomic
+// release store elsewhere) before readers may look at it. Chunks are only
+// freed with the array, so it grows with the highest index ever written.
+template <typename T>
+class ChunkedArray {
+    static const size_t kChunkBits = 12;
+    static const size_t kMaxChunks = 1 << 16;
+
+    unique_ptr<atomic<T*>[]> chunks;
+
+public:
+    // Indexes must stay below this (2^28); callers bound their IDs by it.
+    static const size_t kCapacity = kMaxChunks << kChunkBits;
+
+    ChunkedArray() : chunks(new atomic<T*>[kMaxChunks]()) {}
+    ChunkedArray(const ChunkedArray&) = delete;
+    ChunkedArray& operator=(const ChunkedArray&) = delete;
+
+    ~ChunkedArray() {
+        for (size_t c = 0; c < kMaxChunks; ++c)
+            delete[] chunks[c].load(memory_order_relaxed);
+    }
+
+    // Element i, or nullptr if nothing near it was ever written.
+    T* find(size_t i) const {
+        if (i >= kCapacity)
+            return nullptr;
+        T* chunk = chunks[i >> kChunkBits].load(memory_order_acquire);
+        return chunk == nullptr ? nullptr : &chunk[i & ((1 << kChunkBits) - 1)];
+    }
+
+    // Element i, allocating its chunk if needed. Safe to call concurrently.
+    // An index past kCapacity is a bug in the caller and aborts.
+    T& at(size_t i) {
+        if (i >= kCapacity) {
+            fprintf(stderr, "ChunkedArray: index %zu is past the capacity of %zu\n", i, kCapacity);
+            abort();
+        }
+        atomic<T*>& slot = chunks[i >> kChunkBits];
+        T* chunk = slot.load(memory_order_acquire);
+        if (chunk == nullptr) {
+            T* fresh = new T[1 << kChunkBits]();
+            if (slot.compare_exchange_strong(chunk, fresh, memory_order_acq_rel, memory_order_acquire))
+                chunk = fresh;
+            else
+                delete[] fresh;   // another writer got there first
+        }
+        return chunk[i & ((1 << kChunkBits) - 1)];
+    }
+};
+
+// PlateInterner: license plate <-> vehicle ID. Lookups take no lock: plates
+// live in a ChunkedArray and the ID table is an open-addressing array of
+// atomic words, each holding the high half of the plate's hash next to its
+// ID. New plates are added under `mtx`, one at a time, and published by the
+// release store of their table word. IDs are never removed, so a reader
+// probing while a plate is added sees either the new word or an empty slot.
+// When the table grows, a new one is built and swapped in; the old one is
+// kept until the interner is destroyed, since a reader may still be probing
+// it (the tables double, so together they stay smaller than the current one).
+// Since IDs are never recycled, the interner and every array indexed by ID
+// grow with the number of distinct plates ever seen, up to kMaxId of them.
+class PlateInterner {
+    struct IdTable {
+        uint64_t mask;
+        unique_ptr<atomic<uint64_t>[]> slots;   // (hash >> 32) << 32 | id; 0 = empty
+
+        explicit IdTable(uint64_t size) : mask(size - 1), slots(new atomic<uint64_t>[size]()) {}
+    };
+
+    mutex mtx;
+    // IDs 1..frozen.count; used in place.
+    FrozenPlates frozen;
+    atomic<IdTable*> table;
+    vector<unique_ptr<IdTable>> tables;   // current and retired, owned
+    ChunkedArray<string> plates;          // plates.at(id - frozen.count - 1)
+    atomic<uint32_t> count;               // plates interned here, not counting frozen ones
+
+    VehicleId findInterned(string_view licensePlate, uint64_t hash) const {
+        const IdTable* t = table.load(memory_order_acquire);
+        uint32_t tag = hash >> 32;
+        for (uint64_t i = tag & t->mask;; i = (i + 1) & t->mask) {
+            uint64_t word = t->slots[i].load(memory_order_acquire);
+            if (word == 0)
+                return kNoVehicle;
+            VehicleId id = (VehicleId)word;
+            if ((uint32_t)(word >> 32) == tag && *plates.find(id - frozen.count - 1) == licensePlate)
+                return id;
+        }
+    }
+
+    static void insert(IdTable& t, uint64_t word) {
+        uint64_t i = (word >> 32) & t.mask;
+        while (t.slots[i].load(memory_order_relaxed) != 0)
+            i = (i + 1) & t.mask;
+        t.slots[i].store(word, memory_order_release);
+    }
+
+public:
+    // Highest ID handed out. IDs index ChunkedArrays, here and in the lot.
+    static const VehicleId kMaxId = ChunkedArray<string>::kCapacity - 1;
+
+    PlateInterner() : count(0) {
+        tables.emplace_back(new IdTable(1024));
+        table.store(tables.back().get(), memory_order_release);
+    }
+
+    // Returns the ID for `licensePlate`, assigning the next one if it is new.
+    // IDs are never recycled, so a returning vehicle keeps its ID. Returns
+    // kNoVehicle for a new plate once kMaxId plates have been interned.
+    VehicleId intern(const string& licensePlate) {
+        VehicleId id = frozen.find(licensePlate);
+        if (id != kNoVehicle)
+            return id;
+        uint64_t hash = plateHash(licensePlate);
+        id = findInterned(licensePlate, hash);
+        if (id != kNoVehicle)
+            return id;
+        lock_guard<mutex> lock(mtx);
+        id = findInterned(licensePlate, hash);
+        if (id != kNoVehicle)
+            return id;
+        uint32_t n = count.load(memory_order_relaxed);
+        if ((uint64_t)frozen.count + n >= kMaxId)
+            return kNoVehicle;   // out of IDs
+        id = (VehicleId)(frozen.count + n + 1);
+        plates.at(n) = licensePlate;
+        IdTable* t = table.load(memory_order_relaxed);
+        if ((uint64_t)(n + 1) * 2 > t->mask + 1) {
+            // Grow to keep the load factor under 1/2. The tag holds the high
+            // hash bits, so entries move without rehashing their plates.
+            unique_ptr<IdTable> bigger(new IdTable((t->mask + 1) * 2));
+            for (uint64_t i = 0; i <= t->mask; ++i) {
+                uint64_t word = t->slots[i].load(memory_order_relaxed);
+                if (word != 0)
+                    insert(*bigger, word);
+            }
+            t = bigger.get();
+            tables.push_back(move(bigger));
+            insert(*t, (hash >> 32) << 32 | id);
+            table.store(t, memory_order_release);
+        } else {
+            insert(*t, (hash >> 32) << 32 | id);
+        }
+        count.store(n + 1, memory_order_release);
+        return id;
+    }
+
+    // Returns the ID for `licensePlate`, or kNoVehicle if it was never interned.
+    VehicleId find(const string& licensePlate) const {
+        VehicleId id = frozen.find(licensePlate);
+        if (id != kNoVehicle)
+            return id;
+        return findInterned(licensePlate, plateHash(licensePlate));
+    }
+
+    // License plate for an ID returned by intern().
+    string_view plate(VehicleId id) const {
+        if (id <= frozen.count)
+            return frozen.plate(id);
+        return *plates.find(id - frozen.count - 1);
+    }
+
+    // Number of plates interned so far (the highest ID handed out).
+    size_t size() const {
+        return frozen.count + count.load(memory_order_acquire);
+    }
+
+    // Take IDs 1..base.count from `base`, which must outlive the interner.
+    // Only valid while nothing has been interned yet and no reader is active.
+    void setFrozenPlates(const FrozenPlates& base) {
+        lock_guard<mutex> lock(mtx);
+        assert(count.load() == 0 && frozen.count == 0);
+        frozen = base;
+    }
+};
+
+//------------------------------------------------------
+// ParkingSpot Class: lightweight, read-only view of one spot. Spots are stored
+// by their Floor in contiguous arrays; a view is just (floor, spot index) and
+// is cheap to copy. Valid as long as the Floor is.
+class Floor;
+
 class ParkingSpot {
+    const Floor* floor;
+    int index;
+
+public:
+    ParkingSpot(const Floor* floor, int index) : floor(floor), index(index) {}
+
+    int floorNumber() const;
+    int spotNumber() const { return index; }
+    bool isOccupied() const;
+    VehicleId parkedVehicle() const; // ID of parked vehicle (kNoVehicle if none)
+};
+
+//------------------------------------------------------
+// Operation statistics.
+//
+// Latency histograms for park/remove/find, time spent waiting for floor and
+// vehicle index locks, search steps per floor search and outcome counts.
+// Each thread records into its own ThreadStats, so recording never contends
+// with other threads; the `stats` command sums them. Reading the clock costs
+// about as much as a find, so each thread times one call in
+// PARKINGLOT_STATS_SAMPLE (default 8; 1 times every call); outcomes are
+// counted for every call. Building with -DPARKINGLOT_NO_STATS compiles every
+// recording call away.
+
+enum class StatOp { Park, Remove, Find };
+static const int kStatOps = 3;
+static const int kStatOutcomes = 6;   // one per ParkingStatus
+
+#ifndef PARKINGLOT_NO_STATS
+
+#ifndef PARKINGLOT_STATS_SAMPLE
+#define PARKINGLOT_STATS_SAMPLE 8
+#endif
+static_assert(PARKINGLOT_STATS_SAMPLE >= 1, "PARKINGLOT_STATS_SAMPLE must be at least 1");
+
+// Add to a counter only its owning thread writes: a relaxed load and store,
+// no locked read-modify-write, still safe for other threads to read.
+inline void bumpCounter(atomic<uint64_t>& counter, uint64_t by = 1) {
+    counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+// HDR-style histogram: exact below 32, then 16 buckets per power of two
+// (within 1/16 of the true value) up to 2^40. Recorded into by one thread.
+class Histogram {
+public:
+    static const int kSubBuckets = 16;
+    static const int kBuckets = 37 * kSubBuckets;
+
+private:
+    atomic<uint64_t> counts[kBuckets] = {};
+    atomic<uint64_t> total{0};
+    atomic<uint64_t> sum{0};
+    atomic<uint64_t> maximum{0};
+
+    static int bucketOf(uint64_t value) {
+        value = min<uint64_t>(value, (1ULL << 40) - 1);
+        if (value < kSubBuckets)
+            return (int)value;
+        int exponent = 63 - __builtin_clzll(value);
+        return (exponent - 3) * kSubBuckets + (int)((value >> (exponent - 4)) & (kSubBuckets - 1));
+    }
+
+    // Largest value that falls in `bucket`.
+    static uint64_t bucketTop(int bucket) {
+        if (bucket < kSubBuckets)
+            return bucket;
+        int exponent = bucket / kSubBuckets + 3;
+        uint64_t low = (uint64_t)(kSubBuckets + bucket % kSubBuckets) << (exponent - 4);
+        return low + (1ULL << (exponent - 4)) - 1;
+    }
+
+public:
+    void record(uint64_t value) {
+        bumpCounter(counts[bucketOf(value)]);
+        bumpCounter(total);
+        bumpCounter(sum, value);
+        if (value > maximum.load(memory_order_relaxed))
+            maximum.store(value, memory_order_relaxed);
+    }
+
+    // Add another thread's histogram into this one. Single-threaded.
+    void merge(const Histogram& other) {
+        for (int b = 0; b < kBuckets; ++b)
+            bumpCounter(counts[b], other.counts[b].load(memory_order_relaxed));
+        bumpCounter(total, other.total.load(memory_order_relaxed));
+        bumpCounter(sum, other.sum.load(memory_order_relaxed));
+        maximum.store(max(maximum.load(memory_order_relaxed), other.maximum.load(memory_order_relaxed)),
+                      memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    uint64_t maxValue() const { return maximum.load(memory_order_relaxed); }
+
+    double mean() const {
+        uint64_t n = count();
+        return n == 0 ? 0 : (double)sum.load(memory_order_relaxed) / n;
+    }
+
+    // Value at quantile q in [0, 1], rounded up to its bucket's top.
+    uint64_t percentile(double q) const {
+        uint64_t n = count();
+        if (n == 0)
+            return 0;
+        // Nearest rank: the smallest value with at least q * n samples at or below it.
+        uint64_t rank = min(n, max<uint64_t>(1, (uint64_t)ceil(q * n)));
+        uint64_t seen = 0;
+        for (int b = 0; b < kBuckets; ++b) {
+            seen += counts[b].load(memory_order_relaxed);
+            if (seen >= rank)
+                return min(bucketTop(b), maxValue());
+        }
+        return maxValue();
+    }
+};
+
+struct ThreadStats {
+    Histogram latency[kStatOps];    // ns per timed call
+    Histogram lockWait;             // ns, per lock acquisition that had to wait
+    Histogram searchSteps;          // per floor search
+    atomic<uint64_t> lockAcquisitions{0};
+    atomic<uint64_t> outcomes[kStatOps][kStatOutcomes] = {};
+    atomic<bool> inUse{true};       // false once its thread has exited
+
+    void merge(const ThreadStats& other) {
+        for (int op = 0; op < kStatOps; ++op) {
+            latency[op].merge(other.latency[op]);
+            for (int k = 0; k < kStatOutcomes; ++k)
+                bumpCounter(outcomes[op][k], other.outcomes[op][k].load(memory_order_relaxed));
+        }
+        lockWait.merge(other.lockWait);
+        searchSteps.merge(other.searchSteps);
+        bumpCounter(lockAcquisitions, other.lockAcquisitions.load(memory_order_relaxed));
+    }
+};
+
+// Every ThreadStats ever handed out. A thread's stats outlive it and are
+// handed to the next new thread, so totals keep counting and memory stays
+// bounded by the peak thread count.
+class StatsRegistry {
+    mutex mtx;
+    vector<unique_ptr<ThreadStats>> all;
+
+public:
+    static StatsRegistry& instance() {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    ThreadStats* acquire() {
+        lock_guard<mutex> lock(mtx);
+        for (auto& stats : all) {
+            if (!stats->inUse.load(memory_order_acquire)) {
+                stats->inUse.store(true, memory_order_relaxed);
+                return stats.get();
+            }
+        }
+        all.emplace_back(new ThreadStats());
+        return all.back().get();
+    }
+
+    // Totals over every thread so far.
+    unique_ptr<ThreadStats> collect() {
+        unique_ptr<ThreadStats> totals(new ThreadStats());
+        lock_guard<mutex> lock(mtx);
+        for (auto& stats : all)
+            totals->merge(*stats);
+        return totals;
+    }
+};
+
+// The calling thread's stats; registered on first use, released at exit.
+inline ThreadStats& threadStats() {
+    static thread_local ThreadStats* current = nullptr;
+    if (current == nullptr) {
+        struct Release {
+            ThreadStats* stats;
+            ~Release() { stats->inUse.store(false, memory_order_release); }
+        };
+        static thread_local Release release{StatsRegistry::instance().acquire()};
+        current = release.stats;
+    }
+    return *current;
+}
+
+// Floor searches count their steps (bitmap words read, run index nodes
+// visited) here; SearchStepScope records the total of one search.
+static thread_local uint64_t searchStepCount = 0;
+
+inline void countSearchSteps(int steps = 1) {
+    searchStepCount += steps;
+}
+
+class SearchStepScope {
+    uint64_t start;
+
+public:
+    SearchStepScope() : start(searchStepCount) {}
+    ~SearchStepScope() { threadStats().searchSteps.record(searchStepCount - start); }
+};
+
+// Lock `m`, recording how long this thread waited if another held it.
+inline void lockCounted(mutex& m) {
+    ThreadStats& stats = threadStats();
+    bumpCounter(stats.lockAcquisitions);
+    if (m.try_lock())
+        return;
+    auto start = chrono::steady_clock::now();
+    m.lock();
+    stats.lockWait.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+}
+
+// Count one outcome of a park/remove/find (also used per vehicle by the
+// bulk calls, which record no latency).
+template <typename Status>
+inline void countOutcome(StatOp op, Status status) {
+    bumpCounter(threadStats().outcomes[(int)op][(int)status]);
+}
+
+// Times one park/remove/find call from construction to finish(), if it is
+// this thread's turn to be sampled.
+class OperationTimer {
+    StatOp op;
+    bool timed;
+    chrono::steady_clock::time_point start;
+
+    static bool sampleThisCall() {
+        static thread_local unsigned calls = 0;
+        return ++calls % PARKINGLOT_STATS_SAMPLE == 0;
+    }
+
+public:
+    explicit OperationTimer(StatOp op) : op(op), timed(sampleThisCall()) {
+        if (timed)
+            start = chrono::steady_clock::now();
+    }
+
+    // Record the outcome (and latency, if timed) of the call; returns `result`.
+    template <typename Result>
+    Result finish(Result result) {
+        ThreadStats& stats = threadStats();
+        if (timed)
+            stats.latency[(int)op].record(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        bumpCounter(stats.outcomes[(int)op][(int)result.status]);
+        return result;
+    }
+};
+
+#else   // PARKINGLOT_NO_STATS: the same interface, doing nothing.
+
+inline void countSearchSteps(int = 1) {}
+
+struct SearchStepScope {
+    SearchStepScope() {}
+};
+
+inline void lockCounted(mutex& m) {
+    m.lock();
+}
+
+template <typename Status>
+inline void countOutcome(StatOp, Status) {}
+
+class OperationTimer {
+public:
+    explicit OperationTimer(StatOp) {}
+
+    template <typename Result>
+    Result finish(Result result) {
+        return result;
+    }
+};
+
+#endif
+
+// lock_guard-style ownership of a mutex taken with lockCounted.
+inline unique_lock<mutex> lockCountedGuard(mutex& m) {
+    lockCounted(m);
+    return unique_lock<mutex>(m, adopt_lock);
+}
+
+// The `stats` command: totals over every thread since the program started.
+static void printStats(ostream& out) {
+#ifdef PARKINGLOT_NO_STATS
+    out << "Statistics are disabled in this build (PARKINGLOT_NO_STATS)." << '\n';
+#else
+    unique_ptr<ThreadStats> totals = StatsRegistry::instance().collect();
+    out << "Latency: one call in " << PARKINGLOT_STATS_SAMPLE << " per thread is timed." << '\n';
+    out << left << setw(14) << "" << right << setw(10) << "count" << setw(10) << "mean"
+        << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "p99.9"
+        << setw(10) << "max" << '\n';
+    auto row = [&](const char* name, const Histogram& histogram) {
+        out << left << setw(14) << name << right << setw(10) << histogram.count()
+            << setw(10) << (uint64_t)(histogram.mean() + 0.5);
+        for (double q : {0.50, 0.90, 0.99, 0.999})
+            out << setw(10) << histogram.percentile(q);
+        out << setw(10) << histogram.maxValue() << '\n';
+    };
+    row("park ns", totals->latency[(int)StatOp::Park]);
+    row("remove ns", totals->latency[(int)StatOp::Remove]);
+    row("find ns", totals->latency[(int)StatOp::Find]);
+    row("lock wait ns", totals->lockWait);
+    row("search steps", totals->searchSteps);
+    out << "Lock acquisitions: " << totals->lockAcquisitions.load() << ", waited: " << totals->lockWait.count()
+        << '\n';
+
+    // Outcomes by ParkingStatus: parked, already parked, no space, removed, found, not found.
+    static const char* const names[kStatOutcomes] = {
+        "parked", "already_parked", "no_space", "removed", "found", "not_found"
+    };
+    static const char* const ops[kStatOps] = {"park", "remove", "find"};
+    static const int shown[kStatOps][3] = {{0, 1, 2}, {3, 5, -1}, {4, 5, -1}};
+    for (int op = 0; op < kStatOps; ++op) {
+        out << ops[op] << ':';
+        for (int k : shown[op])
+            if (k >= 0)
+                out << ' ' << names[k] << ' ' << totals->outcomes[op][k].load();
+        out << '\n';
+    }
+#endif
+}
+
+//------------------------------------------------------
+// FreeRunIndex: segment tree over a floor's spots. Each node stores the longest
+// free run inside its range plus the free runs touching its two edges, so the
+// leftmost run of k consecutive free spots is found in O(log spots).
+class FreeRunIndex {
+    struct Node {
+        int prefix;  // free spots at the start of the range
+        int suffix;  // free spots at the end of the range
+        int best;    // longest free run inside the range
+    };
+
+    int leaves;          // number of leaves (power of two >= numSpots)
+    vector<Node> tree;   // 1-based heap layout, leaves at [leaves, 2*leaves)
+
+    static Node combine(const Node& left, const Node& right, int half) {
+        Node node;
+        node.prefix = (left.prefix == half) ? half + right.prefix : left.prefix;
+        node.suffix = (right.suffix == half) ? half + left.suffix : right.suffix;
+        node.best = max(max(left.best, right.best), left.suffix + right.prefix);
+        return node;
+    }
+
+public:
+    explicit FreeRunIndex(int numSpots) : leaves(1) {
+        while (leaves < numSpots)
+            leaves *= 2;
+        tree.assign(2 * leaves, Node{0, 0, 0});
+        // Real spots start free; padding leaves stay occupied.
+        for (int i = 0; i < numSpots; ++i)
+            tree[leaves + i] = Node{1, 1, 1};
+        build();
+    }
+
+    // Reset every spot from an occupancy bitmap (bit set = occupied) in one
+    // O(spots) pass, instead of one update() per spot.
+    void assign(const uint64_t* occupancy, int numSpots) {
+        for (int i = 0; i < leaves; ++i) {
+            int v = (i < numSpots && !((occupancy[i / 64] >> (i % 64)) & 1)) ? 1 : 0;
+            tree[leaves + i] = Node{v, v, v};
+        }
+        build();
+    }
+
+    // Mark one spot free or occupied and refresh its ancestors.
+    void update(int idx, bool isFree) {
+        int i = leaves + idx;
+        int v = isFree ? 1 : 0;
+        tree[i] = Node{v, v, v};
+        for (int half = 1; i > 1; half *= 2) {
+            i /= 2;
+            tree[i] = combine(tree[2 * i], tree[2 * i + 1], half);
+        }
+    }
+
+    // Length of the longest free run on the floor.
+    int longestRun() const {
+        return tree[1].best;
+    }
+
+    // Returns the first spot of the leftmost run of `length` free spots, or -1.
+    int findRun(int length) const {
+        if (length <= 0 || tree[1].best < length)
+            return -1;
+        int i = 1;
+        int start = 0;
+        int half = leaves / 2;
+        while (i < leaves) {
+            countSearchSteps();
+            const Node& left = tree[2 * i];
+            const Node& right = tree[2 * i + 1];
+            if (left.best >= length) {
+                i = 2 * i;
+            } else if (left.suffix + right.prefix >= length) {
+                return start + half - left.suffix;
+            } else {
+                i = 2 * i + 1;
+                start += half;
+            }
+            half /= 2;
+        }
+        return start;
+    }
+
+    // Like findRun, but only considers runs starting at or after `from`.
+    int findRunFrom(int length, int from) const {
+        if (from <= 0)
+            return findRun(length);
+        if (length <= 0 || tree[1].best < length)
+            return -1;
+        int carry = 0;
+        return searchFrom(1, 0, leaves, from, length, carry);
+    }
+
+private:
+    // Recompute every inner node bottom-up, one level at a time; `half` is
+    // the width of a child range.
+    void build() {
+        for (int levelStart = leaves / 2, half = 1; levelStart >= 1; levelStart /= 2, half *= 2) {
+            for (int i = levelStart; i < 2 * levelStart; ++i)
+                tree[i] = combine(tree[2 * i], tree[2 * i + 1], half);
+        }
+    }
+
+    // Scans the range [start, start + width) of `node` left to right, ignoring
+    // spots before `from`. `carry` is the length of the free run (starting at
+    // or after `from`) that ends just before this range. Only descends into
+    // nodes that straddle `from` or are known to contain a long enough run,
+    // so the search is O(log spots).
+    int searchFrom(int node, int start, int width, int from, int length, int& carry) const {
+        if (start + width <= from)
+            return -1;
+        countSearchSteps();
+        const Node& n = tree[node];
+        if (start >= from) {
+            if (carry + n.prefix >= length)
+                return start - carry;
+            if (n.best < length) {
+                carry = (n.prefix == width) ? carry + width : n.suffix;
+                return -1;
+            }
+        }
+        int half = width / 2;
+        int found = searchFrom(2 * node, start, half, from, length, carry);
+        if (found >= 0)
+            return found;
+        return searchFrom(2 * node + 1, start + half, half, from, length, carry);
+    }
+};
+
+//------------------------------------------------------
+// Allocation policies, selectable per ParkingLot.
+//   FirstFit: lowest-numbered spot(s) that fit. Fills floors from the front.
+//   NextFit:  like FirstFit, but each floor resumes from just after its last
+//             placement (wrapping around), so a filled prefix is not rescanned.
+//   BestFit:  the free run closest in length to what the vehicle needs, so
+//             Bikes/Cars fill isolated holes and long runs are kept for Trucks.
+//             Scans the whole floor bitmap on every search.
+enum class AllocationPolicy {
+    FirstFit,
+    NextFit,
+    BestFit
+};
+
+//------------------------------------------------------
+// How floors guard their spots, fixed per ParkingLot.
+//   FloorLock:    park/remove hold the floor's mutex while they search and
+//                 edit its spots.
+//   AtomicBitmap: spots are claimed by compare-and-swap on the occupancy
+//                 words and freed with atomic AND, so gates parking on the
+//                 same floor never wait for each other. Supports FirstFit and
+//                 NextFit; BestFit needs a stable view of the whole floor.
+enum class ClaimMode {
+    FloorLock,
+    AtomicBitmap
+};
+
+//------------------------------------------------------
+// Floor Class: Each floor manages its parking spots.
+class Floor {
 public:
     int floorNumber;
-    int spotNumber;
-    bool isOccupied;
-    string parkedVehicle; // License plate of parked vehicle (empty if none)
+    // How writers are kept apart; see ClaimMode.
+    const bool atomicClaims;
+    // FloorLock: guards this floor's spots; held by ParkingLot while it
+    // searches or edits them. AtomicBitmap: only taken by code that needs the
+    // whole floor at once (lockExclusive) and by writers that arrive while
+    // such code runs.
+    mutex mtx;
+    // AtomicBitmap: parks/removes currently editing the floor without mtx,
+    // and whether lockExclusive is waiting for them to finish.
+    atomic<int> activeWriters;
+    atomic<bool> quiescing;
+    // Spot state is stored struct-of-arrays, indexed by spot number.
+    // Packed occupancy bitmap, one bit per spot (1 = occupied). Bits past the
+    // last spot are kept set so searches never report them as free. Under
+    // FloorLock the words are read and written relaxed, i.e. as plain words.
+    vector<atomic<uint64_t>> occupancy;
+    // Free-run index used for vehicles that need several consecutive spots.
+    // Not maintained for AtomicBitmap floors, which scan the bitmap instead.
+    FreeRunIndex freeRuns;
+    // Number of free spots, maintained on every park/remove so readers can
+    // poll it without taking the floor lock.
+    atomic<int> freeSpots;
+    // ID of the vehicle parked in each spot (kNoVehicle if none). Written only
+    // by whoever holds the spot.
+    vector<VehicleId> parkedVehicles;
+    // Type of the vehicle parked in each spot (meaningless if free). Lets a
+    // snapshot describe every parked vehicle from the floors alone.
+    vector<uint8_t> parkedTypes;
+    // Spot after the most recent placement; where NextFit searches resume.
+    // Only a hint for AtomicBitmap floors.
+    atomic<int> nextFitCursor;
+
+    // Constructor
+    // A non-positive `numSpots` gives an empty floor that rejects every park.
+    Floor(int floorNumber, int numSpots, ClaimMode claimMode = ClaimMode::FloorLock)
+        : floorNumber(floorNumber), atomicClaims(claimMode == ClaimMode::AtomicBitmap),
+          activeWriters(0), quiescing(false), occupancy((max(numSpots, 0) + 63) / 64),
+          freeRuns(max(numSpots, 0)), freeSpots(max(numSpots, 0)),
+          parkedVehicles(max(numSpots, 0), kNoVehicle), parkedTypes(max(numSpots, 0), 0),
+          nextFitCursor(0)
+    {
+        for (auto& word : occupancy)
+            word.store(0, memory_order_relaxed);
+        if (numSpots > 0 && numSpots % 64 != 0)
+            occupancy.back().store(~0ULL << (numSpots % 64), memory_order_relaxed);
+    }
+
+    // Number of spots on the floor.
+    int spotCount() const {
+        return (int)parkedVehicles.size();
+    }
+
+    uint64_t occupancyWord(size_t w) const {
+        return occupancy[w].load(memory_order_relaxed);
+    }
+
+    bool isOccupied(int idx) const {
+        return (occupancyWord(idx / 64) >> (idx % 64)) & 1;
+    }
+
+    // View of one spot, for callers that want the ParkingSpot interface.
+    ParkingSpot spot(int idx) const {
+        return ParkingSpot(this, idx);
+    }
+
+    // Take the whole floor: no park or remove runs until unlockExclusive.
+    // For AtomicBitmap floors this also waits for writers already inside.
+    void lockExclusive() {
+        mtx.lock();
+        if (atomicClaims) {
+            quiescing.store(true);
+            while (activeWriters.load() != 0)
+                this_thread::yield();
+        }
+    }
+
+    void unlockExclusive() {
+        if (atomicClaims)
+            quiescing.store(false);
+        mtx.unlock();
+    }
+
+    // Find available spot(s) for a given vehicle under `policy`.
+    // Returns the spot numbers if found; an empty list if not. First-fit
+    // single-spot searches start at `fromSpot`; callers pass a nonzero value
+    // only when they know every spot below it is taken. FloorLock floors only.
+    SpotList findAvailableSpots(const Vehicle* vehicle,
+                                AllocationPolicy policy = AllocationPolicy::FirstFit,
+                                int fromSpot = 0) {
+        SearchStepScope searchSteps;
+        int required = vehicle->getRequiredSpots();
+        SpotList availableSpots;
+        if (required < 1 || required > kMaxSpotsPerVehicle)
+            return availableSpots;
+
+        // Bikes/Cars scan the bitmap a word at a time; Trucks (or anything
+        // larger) need `required` consecutive free spots from the run index.
+        int cursor = nextFitCursor.load(memory_order_relaxed);
+        int start = -1;
+        switch (policy) {
+        case AllocationPolicy::FirstFit:
+            start = (required == 1) ? findFreeSpot(fromSpot) : freeRuns.findRun(required);
+            break;
+        case AllocationPolicy::NextFit:
+            start = (required == 1) ? findFreeSpot(cursor) : freeRuns.findRunFrom(required, cursor);
+            if (start < 0)   // wrap around
+                start = (required == 1) ? findFreeSpot(0) : freeRuns.findRun(required);
+            break;
+        case AllocationPolicy::BestFit:
+            start = findBestFitRun(required);
+            break;
+        }
+        if (start >= 0) {
+            for (int i = 0; i < required; ++i)
+                availableSpots.push_back(start + i);
+        }
+        return availableSpots;
+    }
+
+    // Find and take spot(s) for vehicle `id` in one step: a search plus
+    // parkVehicle for FloorLock floors, a compare-and-swap claim for
+    // AtomicBitmap floors (where a search result could be stale by the time
+    // it is used). Returns false, with `spots` empty, if nothing fits.
+    bool claimSpots(VehicleId id, const Vehicle* vehicle, AllocationPolicy policy, int fromSpot,
+                    SpotList& spots) {
+        if (!atomicClaims) {
+            spots = findAvailableSpots(vehicle, policy, fromSpot);
+            return !spots.empty() && parkVehicle(id, vehicle->type, spots);
+        }
+        SearchStepScope searchSteps;
+        spots = SpotList();
+        int required = vehicle->getRequiredSpots();
+        if (required < 1 || required > kMaxSpotsPerVehicle)
+            return false;
+        int from = (policy == AllocationPolicy::NextFit) ? nextFitCursor.load(memory_order_relaxed)
+                                                          : fromSpot;
+        int start = claimRunFrom(required, from);
+        if (start < 0 && from > 0)   // wrap around
+            start = claimRunFrom(required, 0);
+        if (start < 0)
+            return false;
+        for (int i = 0; i < required; ++i)
+            spots.push_back(start + i);
+        assignSpots(id, vehicle->type, spots);
+        return true;
+    }
+
+    // Park vehicle `id` in specified spots. Returns true if successful.
+    bool parkVehicle(VehicleId id, VehicleType type, const SpotList& spotNumbers) {
+        if (atomicClaims) {
+            // The spots are consecutive; claim them all or none.
+            int first = spotNumbers.empty() ? -1 : spotNumbers.front();
+            int count = spotNumbers.size();
+            if (first < 0 || first + count > spotCount() || !claimRun(first, count))
+                return false;
+            assignSpots(id, type, spotNumbers);
+            return true;
+        }
+        // Verify that the spots are still available.
+        for (int idx : spotNumbers) {
+            if (idx < 0 || idx >= spotCount() || isOccupied(idx))
+                return false;
+        }
+        // Assign vehicle to the spots.
+        for (int idx : spotNumbers)
+            setOccupied(idx, true);
+        assignSpots(id, type, spotNumbers);
+        return true;
+    }
+
+    // Whether every spot in the list exists and is occupied, i.e. could be
+    // freed by removeVehicle.
+    bool spotsOccupied(const SpotList& spotNumbers) const {
+        for (int idx : spotNumbers) {
+            if (idx < 0 || idx >= spotCount() || !isOccupied(idx))
+                return false;
+        }
+        return !spotNumbers.empty();
+    }
+
+    // Remove vehicle from the spot(s) recorded for it at park time. Touches only
+    // those spots, so the cost does not depend on floor size. Returns false
+    // (and frees nothing) if any spot is out of range or already free.
+    bool removeVehicle(VehicleId id, const SpotList& spotNumbers) {
+        if (!spotsOccupied(spotNumbers))
+            return false;
+        for (int idx : spotNumbers) {
+            // Debug builds also check the spot really belongs to this vehicle.
+            assert(parkedVehicles[idx] == id);
+            // Clear the owner before the spot can be claimed again.
+            parkedVehicles[idx] = kNoVehicle;
+            setOccupied(idx, false);
+        }
+        (void)id;
+        return true;
+    }
+
+    // Replace the whole floor with arrays laid out like occupancy,
+    // parkedVehicles and parkedTypes (as saved in a snapshot). Caller holds
+    // the floor exclusively.
+    void restore(const uint64_t* bits, const VehicleId* owners, const uint8_t* types) {
+        memcpy(parkedVehicles.data(), owners, parkedVehicles.size() * sizeof(VehicleId));
+        memcpy(parkedTypes.data(), types, parkedTypes.size());
+        int padding = (int)occupancy.size() * 64 - spotCount();
+        int occupied = -padding;
+        for (size_t w = 0; w < occupancy.size(); ++w) {
+            uint64_t word = bits[w];
+            if (w + 1 == occupancy.size() && padding > 0)
+                word |= ~0ULL << (64 - padding);
+            occupancy[w].store(word, memory_order_relaxed);
+            occupied += __builtin_popcountll(word);
+        }
+        freeSpots.store(spotCount() - occupied, memory_order_relaxed);
+        freeRuns.assign(bits, spotCount());
+        nextFitCursor.store(0, memory_order_relaxed);
+    }
+
+    // Count available spots on the floor. Wait-free; safe without the floor lock.
+    int availableSpotsCount() const {
+        return freeSpots.load(memory_order_relaxed);
+    }
+
+private:
+    // Record the owner of freshly taken spots and move the NextFit cursor.
+    void assignSpots(VehicleId id, VehicleType type, const SpotList& spotNumbers) {
+        for (int idx : spotNumbers) {
+            parkedVehicles[idx] = id;
+            parkedTypes[idx] = (uint8_t)type;
+        }
+        if (!spotNumbers.empty()) {
+            int next = spotNumbers[spotNumbers.size() - 1] + 1;
+            nextFitCursor.store((next < spotCount()) ? next : 0, memory_order_relaxed);
+        }
+    }
+
+    // First free spot at or after `from`, or -1.
+    int findFreeSpot(int from) const {
+        for (size_t w = from / 64; w < occupancy.size(); ++w) {
+            countSearchSteps();
+            uint64_t freeBits = ~occupancyWord(w);
+            if (w == (size_t)from / 64)
+                freeBits &= ~0ULL << (from % 64);
+            if (freeBits != 0)
+                return (int)(w * 64 + __builtin_ctzll(freeBits));
+        }
+        return -1;
+    }
+
+    // Start of the shortest free run of at least `required` spots (leftmost on
+    // ties), or -1. Walks the run boundaries of the bitmap word by word and
+    // stops early on an exact fit.
+    int findBestFitRun(int required) const {
+        if (freeRuns.longestRun() < required)
+            return -1;
+        int bestStart = -1;
+        int bestLength = INT32_MAX;
+        int runStart = -1;
+        for (size_t w = 0; w < occupancy.size(); ++w) {
+            countSearchSteps();
+            uint64_t freeBits = ~occupancyWord(w);
+            int base = (int)w * 64;
+            int bit = 0;
+            while (bit < 64) {
+                if (runStart < 0) {
+                    uint64_t rest = freeBits >> bit;
+                    if (rest == 0)
+                        break;
+                    bit += __builtin_ctzll(rest);
+                    runStart = base + bit;
+                } else {
+                    uint64_t rest = ~freeBits >> bit;
+                    if (rest == 0)
+                        break;   // run continues into the next word
+                    bit += __builtin_ctzll(rest);
+                    int length = base + bit - runStart;
+                    if (length >= required && length < bestLength) {
+                        bestStart = runStart;
+                        bestLength = length;
+                        if (length == required)
+                            return bestStart;
+                    }
+                    runStart = -1;
+                }
+            }
+        }
+        // A run can only still be open if it reaches the last spot.
+        if (runStart >= 0 && spotCount() - runStart >= required && spotCount() - runStart < bestLength)
+            bestStart = runStart;
+        return bestStart;
+    }
+
+    // AtomicBitmap: set the bits in `mask` of word `w` if all are clear.
+    // Retries only while they stay clear. Acquire pairs with the release in
+    // setOccupied, so the previous owner's writes to the spot happen before.
+    bool claimBits(size_t w, uint64_t mask) {
+        uint64_t current = occupancyWord(w);
+        while ((current & mask) == 0) {
+            if (occupancy[w].compare_exchange_weak(current, current | mask, memory_order_acquire,
+                                                   memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    // AtomicBitmap: claim the `count` spots starting at `first`. A run that
+    // crosses into the next word takes two CASes: the low word first, then the
+    // high one, undoing the first if the second finds a spot taken. Another
+    // claimer may therefore briefly see those low spots held and pass them by.
+    bool claimRun(int first, int count) {
+        size_t w = first / 64;
+        int bit = first % 64;
+        int low = min(count, 64 - bit);
+        uint64_t lowMask = ((low == 64) ? ~0ULL : (1ULL << low) - 1) << bit;
+        if (!claimBits(w, lowMask))
+            return false;
+        if (low < count && !claimBits(w + 1, (1ULL << (count - low)) - 1)) {
+            occupancy[w].fetch_and(~lowMask, memory_order_release);
+            return false;
+        }
+        freeSpots.fetch_sub(count);
+        return true;
+    }
+
+    // AtomicBitmap: claim the leftmost run of `required` free spots starting
+    // at or after `from`, scanning the bitmap a word at a time. Returns its
+    // first spot, or -1 if no free run was seen.
+    int claimRunFrom(int required, int from) {
+        for (size_t w = from / 64; w < occupancy.size(); ++w) {
+            int floorBit = (w == (size_t)from / 64) ? from % 64 : 0;
+            for (;;) {
+                countSearchSteps();
+                // Bit i of `starts`: spots i .. i+required-1 of this word are free.
+                uint64_t freeBits = ~occupancyWord(w);
+                uint64_t starts = freeBits & (~0ULL << floorBit);
+                for (int k = 1; k < required; ++k)
+                    starts &= freeBits >> k;
+                if (starts == 0)
+                    break;
+                int first = (int)w * 64 + __builtin_ctzll(starts);
+                if (claimRun(first, required))
+                    return first;
+            }
+            // A run straddling this word and the next: the free spots at the
+            // top of this word plus enough from the bottom of the next.
+            if (required > 1 && w + 1 < occupancy.size()) {
+                uint64_t word = occupancyWord(w);
+                int high = min((word == 0) ? 64 : __builtin_clzll(word), min(required - 1, 64 - floorBit));
+                uint64_t needed = (1ULL << (required - high)) - 1;
+                if (high > 0 && (occupancyWord(w + 1) & needed) == 0) {
+                    int first = (int)w * 64 + 64 - high;
+                    if (claimRun(first, required))
+                        return first;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Keep the occupancy bitmap, free counter and (FloorLock) free-run index in
+    // sync with a spot's state. AtomicBitmap floors only free spots here; they
+    // are taken through claimRun.
+    void setOccupied(int idx, bool occupied) {
+        uint64_t mask = 1ULL << (idx % 64);
+        atomic<uint64_t>& word = occupancy[idx / 64];
+        if (occupied) {
+            word.store(word.load(memory_order_relaxed) | mask, memory_order_relaxed);
+            freeSpots.fetch_sub(1, memory_order_relaxed);
+        } else if (atomicClaims) {
+            word.fetch_and(~mask, memory_order_release);
+            freeSpots.fetch_add(1);
+            return;
+        } else {
+            word.store(word.load(memory_order_relaxed) & ~mask, memory_order_relaxed);
+            freeSpots.fetch_add(1, memory_order_relaxed);
+        }
+        freeRuns.update(idx, !occupied);
+    }
+};
+
+inline int ParkingSpot::floorNumber() const {
+    return floor->floorNumber;
+}
+
+inline bool ParkingSpot::isOccupied() const {
+    return floor->isOccupied(index);
+}
+
+inline VehicleId ParkingSpot::parkedVehicle() const {
+    return floor->parkedVehicles[index];
+}
+
+//------------------------------------------------------
+// Operation results and events.
+//
+// ParkingLot never prints: each operation returns a ParkingResult to the
+// caller and publishes a ParkingEvent to an optional EventSink.
+enum class ParkingStatus {
+    Parked,
+    AlreadyParked,
+    NoSpace,
+    Removed,
+    Found,
+    NotFound
+};
+
+struct ParkingResult {
+    ParkingStatus status;
+    int floorNumber;    // -1 unless the vehicle was parked, removed or found
+    SpotList spots;     // spot numbers on that floor
+    bool logFailed = false;   // parked/removed, but the write-ahead log has failed,
+                              // so the change will not survive a restart
+
+    ParkingResult(ParkingStatus status, int floorNumber = -1, const SpotList& spots = SpotList())
+        : status(status), floorNumber(floorNumber), spots(spots) {}
+};
+
+struct ParkingEvent {
+    ParkingStatus status;
+    string licensePlate;
+    int floorNumber;
+    int firstSpot;      // spots are always consecutive: [firstSpot, firstSpot + spotCount)
+    int spotCount;
+};
+
+// Writes a one-line, human readable description of an event.
+inline ostream& operator<<(ostream& out, const ParkingEvent& event) {
+    static const char* const names[] = {
+        "parked", "already_parked", "no_space", "removed", "found", "not_found"
+    };
+    out << names[static_cast<int>(event.status)] << ' ' << event.licensePlate;
+    if (event.floorNumber >= 0) {
+        out << " floor " << event.floorNumber << " spot(s):";
+        for (int i = 0; i < event.spotCount; ++i)
+            out << ' ' << event.firstSpot + i;
+    }
+    return out;
+}
+
+// Receives events from ParkingLot. publish() is called on the parking path,
+// outside any lock, so implementations must be thread-safe and cheap.
+class EventSink {
+public:
+    virtual ~EventSink() {}
+    virtual void publish(const ParkingEvent& event) = 0;
+};
+
+// EventSink backed by a bounded lock-free ring buffer (Vyukov MPMC queue).
+// Producers never block: when the ring is full the event is dropped and
+// counted. A background thread drains the ring and writes to `out`.
+class RingBufferEventSink : public EventSink {
+    struct Slot {
+        atomic<size_t> sequence;
+        ParkingEvent event;
+    };
+
+    vector<Slot> ring;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueuePos;
+    alignas(64) atomic<size_t> dequeuePos;
+    alignas(64) atomic<size_t> dropped;
+    atomic<bool> stopping;
+    ostream& out;
+    thread writer;
+
+    bool tryPop(ParkingEvent& event) {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        for (;;) {
+            Slot& slot = ring[pos & mask];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    swap(event, slot.event);
+                    slot.sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   // empty
+            } else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    void drain() {
+        ParkingEvent event;
+        while (true) {
+            bool stop = stopping.load(memory_order_acquire);
+            bool wrote = false;
+            while (tryPop(event)) {
+                out << event << '\n';
+                wrote = true;
+            }
+            if (wrote)
+                out.flush();
+            if (stop)
+                break;
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+public:
+    // `capacity` is rounded up to a power of two.
+    explicit RingBufferEventSink(ostream& out, size_t capacity = 1 << 16)
+        : enqueuePos(0), dequeuePos(0), dropped(0), stopping(false), out(out)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        ring = vector<Slot>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+            ring[i].sequence.store(i, memory_order_relaxed);
+        writer = thread(&RingBufferEventSink::drain, this);
+    }
+
+    // Stops the writer after it has flushed every queued event.
+    ~RingBufferEventSink() override {
+        stopping.store(true, memory_order_release);
+        writer.join();
+    }
+
+    void publish(const ParkingEvent& event) override {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        for (;;) {
+            Slot& slot = ring[pos & mask];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    slot.event = event;
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    return;
+                }
+            } else if (diff < 0) {
+                dropped.fetch_add(1, memory_order_relaxed);   // full
+                return;
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Number of events discarded because the ring was full.
+    size_t droppedEvents() const {
+        return dropped.load(memory_order_relaxed);
+    }
+};
+
+//------------------------------------------------------
+// Write-ahead log.
+//
+// Every park and remove that changes the lot is appended to a binary log, so
+// the lot can be rebuilt after a restart. Records carry the floor and spots
+// that were actually chosen and are appended while that floor is locked, so
+// replaying the log in order reproduces the same placements under any
+// allocation policy.
+enum class FsyncPolicy {
+    Always,     // an operation returns once its record is on disk; concurrent
+                // operations share one fsync (group commit)
+    Interval,   // written and fsync'd every interval; a crash loses at most one interval
+    Never       // written every interval; the OS decides when it reaches disk
+};
+
+enum class WalOp : uint8_t {
+    Park = 1,
+    Remove = 2
+};
+
+// On-disk record: this header followed by the license plate bytes. The
+// checksum covers everything after it, so a record torn by a crash is
+// detected and ends recovery.
+struct WalRecordHeader {
+    uint32_t checksum;
+    uint32_t plateLength;
+    uint8_t op;             // WalOp
+    uint8_t vehicleType;    // parks only
+    uint16_t reserved;
+    int32_t floorNumber;
+    int32_t firstSpot;      // spots are consecutive; the count follows from the vehicle type
+};
+static_assert(sizeof(WalRecordHeader) == 20, "WAL record header must stay packed");
+
+// CRC-32 (IEEE), used to detect torn or corrupt log records and snapshots.
+// Eight bytes per step (slicing-by-8, little-endian hosts) so checking a
+// large snapshot stays cheap next to mapping it; the tail goes bytewise.
+static uint32_t crc32(const void* data, size_t size, uint32_t crc = 0) {
+    static const vector<uint32_t> table = [] {
+        vector<uint32_t> t(8 * 256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int k = 1; k < 8; ++k)
+                t[k * 256 + i] = (t[(k - 1) * 256 + i] >> 8) ^ t[t[(k - 1) * 256 + i] & 0xFF];
+        return t;
+    }();
+    const uint32_t* t = table.data();
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint32_t low, high;
+        memcpy(&low, bytes, 4);
+        memcpy(&high, bytes + 4, 4);
+        low ^= crc;
+        crc = t[7 * 256 + (low & 0xFF)] ^ t[6 * 256 + ((low >> 8) & 0xFF)]
+            ^ t[5 * 256 + ((low >> 16) & 0xFF)] ^ t[4 * 256 + (low >> 24)]
+            ^ t[3 * 256 + (high & 0xFF)] ^ t[2 * 256 + ((high >> 8) & 0xFF)]
+            ^ t[1 * 256 + ((high >> 16) & 0xFF)] ^ t[high >> 24];
+    }
+#endif
+    for (; size > 0; --size, ++bytes)
+        crc = t[(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// The log file starts with this header. Positions handed out by the log are
+// logical: a record's position is basePosition plus its offset after the
+// header, so they stay valid when a checkpoint cuts off the front of the file.
+struct WalFileHeader {
+    char magic[8];              // "PLOTWAL1"
+    uint64_t basePosition;      // position of the first record in the file
+};
+
+// fsync the directory holding `path`, so a rename into it is durable.
+static bool syncParentDirectory(const string& path) {
+    size_t slash = path.rfind('/');
+    string dir = (slash == string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = ::open(dir.c_str(), O_RDONLY);
+    if (dirFd < 0)
+        return false;
+    bool ok = ::fsync(dirFd) == 0;
+    ::close(dirFd);
+    return ok;
+}
+
+// Append-only log file with a background flusher. append() only copies the
+// record into an in-memory buffer; the flusher thread writes the buffer out
+// and syncs it according to the FsyncPolicy. Under FsyncPolicy::Always,
+// callers block in waitDurable() until the flusher has synced their record,
+// and every record buffered during one fsync goes out with the next one.
+// After a failed write or sync the file no longer matches the log positions,
+// so the log stops writing altogether and waitDurable() reports the failure
+// for every change from then on.
+class WriteAheadLog {
+    int fd;
+    string path;
+    FsyncPolicy fsyncPolicy;
+    chrono::milliseconds interval;
+
+    mutex mtx;
+    condition_variable flushNeeded;
+    condition_variable flushed;
+    vector<char> buffer;        // records appended since the last flush
+    uint64_t basePosition;      // position of the first record in the file
+    uint64_t appendedPosition;  // position after the newest buffered record
+    uint64_t durablePosition;   // position the flusher has written (and synced)
+    uint64_t syncs;
+    bool flushing;              // the flusher is writing outside the lock
+    bool checkpointing;         // discardBefore() owns the file; the flusher waits
+    bool stopping;
+    atomic<bool> failed;        // set once, on the first I/O error
+    thread flusher;
+
+    bool writeAll(int out, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(out, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // Marks the log failed (once) and wakes every waitDurable() caller.
+    // Parking goes on without durability; each affected change says so.
+    void reportFailure(int error) {
+        if (!failed.load()) {
+            failed.store(true);
+            cerr << "Write-ahead log: " << strerror(error) << "; changes are no longer logged" << endl;
+        }
+        buffer.clear();
+        flushed.notify_all();
+    }
+
+    // Body of discardBefore(); runs with the lock held and the flusher idle.
+    bool rewriteFrom(uint64_t position) {
+        if (failed.load())
+            return false;
+        if (!buffer.empty()) {
+            if (!writeAll(fd, buffer.data(), buffer.size())) {
+                reportFailure(errno);
+                return false;
+            }
+            buffer.clear();
+        }
+        if (::fdatasync(fd) != 0) {
+            reportFailure(errno);
+            return false;
+        }
+        durablePosition = appendedPosition;
+        flushed.notify_all();
+        if (position <= basePosition || position > appendedPosition)
+            return position <= basePosition;
+
+        string tmpPath = path + ".tmp";
+        int out = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (out < 0)
+            return false;
+        WalFileHeader header;
+        memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.basePosition = position;
+        bool ok = writeAll(out, (const char*)&header, sizeof(header));
+        vector<char> chunk(1 << 20);
+        off_t from = sizeof(header) + (position - basePosition);
+        off_t end = sizeof(header) + (appendedPosition - basePosition);
+        while (ok && from < end) {
+            ssize_t n = ::pread(fd, chunk.data(), min<off_t>(chunk.size(), end - from), from);
+            ok = n > 0 && writeAll(out, chunk.data(), n);
+            from += max<ssize_t>(n, 0);
+        }
+        ok = ok && ::fdatasync(out) == 0 && ::rename(tmpPath.c_str(), path.c_str()) == 0;
+        if (!ok) {
+            ::close(out);
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        syncParentDirectory(path);
+        ::close(fd);
+        fd = out;
+        basePosition = position;
+        return true;
+    }
+
+    void flushLoop() {
+        vector<char> pending;
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            if (fsyncPolicy == FsyncPolicy::Always)
+                flushNeeded.wait(lock, [&] { return stopping || (!buffer.empty() && !checkpointing); });
+            else
+                flushNeeded.wait_for(lock, interval, [&] { return stopping; });
+            if (checkpointing)
+                continue;
+            if (buffer.empty()) {
+                if (stopping)
+                    break;
+                continue;
+            }
+            pending.swap(buffer);
+            uint64_t position = appendedPosition;
+            flushing = true;
+            lock.unlock();
+
+            bool ok = writeAll(fd, pending.data(), pending.size());
+            if (ok && fsyncPolicy != FsyncPolicy::Never)
+                ok = ::fdatasync(fd) == 0;
+            int error = errno;
+            pending.clear();
+
+            lock.lock();
+            flushing = false;
+            if (fsyncPolicy != FsyncPolicy::Never)
+                syncs++;
+            if (!ok) {
+                reportFailure(error);
+                continue;
+            }
+            durablePosition = position;
+            flushed.notify_all();
+        }
+    }
+
+public:
+    static constexpr char kMagic[8] = {'P', 'L', 'O', 'T', 'W', 'A', 'L', '1'};
+
+    // Under Interval and Never, buffered records are written every
+    // `intervalMs` (at least 1, so the flusher never spins).
+    explicit WriteAheadLog(FsyncPolicy fsyncPolicy = FsyncPolicy::Interval, int intervalMs = 10)
+        : fd(-1), fsyncPolicy(fsyncPolicy), interval(max(intervalMs, 1)), basePosition(0),
+          appendedPosition(0), durablePosition(0), syncs(0), flushing(false), checkpointing(false),
+          stopping(false), failed(false) {}
+
+    // Flushes and syncs whatever is still buffered, then closes the file.
+    ~WriteAheadLog() {
+        if (fd < 0)
+            return;
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        flushNeeded.notify_one();
+        flusher.join();
+        if (fsyncPolicy != FsyncPolicy::Never)
+            ::fdatasync(fd);
+        ::close(fd);
+    }
+
+    // Opens (or creates) the log at `path` for appending. `validBytes` is the
+    // length of the intact prefix found by readRecords(); anything after it
+    // (a record torn by a crash) is cut off. Returns false on I/O errors.
+    bool open(const string& logPath, uint64_t validBytes) {
+        path = logPath;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+        WalFileHeader header;
+        bool ok;
+        if (validBytes < sizeof(header)) {
+            memcpy(header.magic, kMagic, sizeof(kMagic));
+            header.basePosition = 0;
+            validBytes = sizeof(header);
+            ok = ::ftruncate(fd, 0) == 0 && writeAll(fd, (const char*)&header, sizeof(header));
+        } else {
+            ok = ::pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+        }
+        if (!ok || ::ftruncate(fd, validBytes) != 0 || ::lseek(fd, validBytes, SEEK_SET) < 0) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        basePosition = header.basePosition;
+        appendedPosition = durablePosition = basePosition + validBytes - sizeof(header);
+        flusher = thread(&WriteAheadLog::flushLoop, this);
+        return true;
+    }
+
+    // Buffers one record and returns the log position just after it, for
+    // waitDurable(). Cheap enough to call with a floor lock held.
+    uint64_t append(WalOp op, const string& licensePlate, VehicleType type,
+                    int floorNumber, int firstSpot) {
+        WalRecordHeader header{0, (uint32_t)licensePlate.size(), (uint8_t)op, (uint8_t)type, 0,
+                               floorNumber, firstSpot};
+        const size_t checked = sizeof(header) - sizeof(header.checksum);
+        header.checksum = crc32(licensePlate.data(), licensePlate.size(),
+                                crc32(&header.plateLength, checked));
+
+        lock_guard<mutex> lock(mtx);
+        appendedPosition += sizeof(header) + licensePlate.size();
+        if (failed.load(memory_order_relaxed))
+            return appendedPosition;   // nothing is written any more
+        bool wasEmpty = buffer.empty();
+        const char* raw = reinterpret_cast<const char*>(&header);
+        buffer.insert(buffer.end(), raw, raw + sizeof(header));
+        buffer.insert(buffer.end(), licensePlate.begin(), licensePlate.end());
+        if (wasEmpty && fsyncPolicy == FsyncPolicy::Always)
+            flushNeeded.notify_one();
+        return appendedPosition;
+    }
+
+    // Under FsyncPolicy::Always, blocks until the log is on disk up to
+    // `position`; otherwise returns immediately. Returns false if the record
+    // at `position` will not reach the disk because the log has failed.
+    // Call with no lock held.
+    bool waitDurable(uint64_t position) {
+        if (position == 0)
+            return true;
+        if (fsyncPolicy != FsyncPolicy::Always)
+            return !failed.load(memory_order_relaxed);
+        unique_lock<mutex> lock(mtx);
+        flushed.wait(lock, [&] { return durablePosition >= position || failed.load(); });
+        return durablePosition >= position;
+    }
+
+    // Whether an I/O error has stopped the log.
+    bool hasFailed() const {
+        return failed.load(memory_order_relaxed);
+    }
+
+    // Position after the newest appended record. Stable while every floor
+    // lock is held, since records are only appended under one.
+    uint64_t position() {
+        lock_guard<mutex> lock(mtx);
+        return appendedPosition;
+    }
+
+    // Checkpoint: drops the records before `position`, which a durable
+    // snapshot now covers, by copying the rest into a new file that replaces
+    // the log. Appends wait while this runs. A crash at any point leaves
+    // either the old log or the new one, and both recover to the same state.
+    bool discardBefore(uint64_t position) {
+        unique_lock<mutex> lock(mtx);
+        flushed.wait(lock, [&] { return !checkpointing; });
+        checkpointing = true;
+        flushed.wait(lock, [&] { return !flushing; });
+        bool ok = rewriteFrom(position);
+        checkpointing = false;
+        flushed.notify_all();
+        flushNeeded.notify_one();
+        return ok;
+    }
+
+    // Number of fsyncs issued so far.
+    uint64_t syncCount() {
+        lock_guard<mutex> lock(mtx);
+        return syncs;
+    }
+
+    // Reads just the file header of the log at `path` and sets `basePosition`
+    // to the position of its first record (0 if the file does not exist or
+    // is empty). Returns false if the file is not a write-ahead log.
+    static bool readBasePosition(const string& path, uint64_t& basePosition) {
+        basePosition = 0;
+        FILE* in = fopen(path.c_str(), "rb");
+        if (in == nullptr)
+            return errno == ENOENT;
+        WalFileHeader fileHeader;
+        bool complete = fread(&fileHeader, sizeof(fileHeader), 1, in) == 1;
+        fclose(in);
+        if (!complete)
+            return true;   // empty, or torn while being created
+        if (memcmp(fileHeader.magic, kMagic, sizeof(kMagic)) != 0)
+            return false;
+        basePosition = fileHeader.basePosition;
+        return true;
+    }
+
+    // Reads the log at `path` and calls apply(header, licensePlate, position)
+    // for each intact record in order, where `position` is the log position
+    // just after the record. Stops at the first torn or corrupt record.
+    // `basePosition` is set to the position of the first record and
+    // `validBytes` to the length of the intact prefix (both 0 if the file does
+    // not exist). Returns false if the file is not a write-ahead log or
+    // apply() rejects a record.
+    template <typename Fn>
+    static bool readRecords(const string& path, Fn apply, uint64_t& basePosition, uint64_t& validBytes) {
+        basePosition = 0;
+        validBytes = 0;
+        FILE* in = fopen(path.c_str(), "rb");
+        if (in == nullptr)
+            return errno == ENOENT;
+
+        WalFileHeader fileHeader;
+        if (fread(&fileHeader, sizeof(fileHeader), 1, in) != 1) {
+            fclose(in);
+            return true;   // empty, or torn while being created
+        }
+        if (memcmp(fileHeader.magic, kMagic, sizeof(kMagic)) != 0) {
+            fclose(in);
+            return false;
+        }
+        basePosition = fileHeader.basePosition;
+        validBytes = sizeof(fileHeader);
+
+        bool ok = true;
+        WalRecordHeader header;
+        string licensePlate;
+        const size_t checked = sizeof(header) - sizeof(header.checksum);
+        while (fread(&header, sizeof(header), 1, in) == 1) {
+            if (header.plateLength > (1u << 20))
+                break;
+            licensePlate.resize(header.plateLength);
+            if (header.plateLength > 0 && fread(&licensePlate[0], header.plateLength, 1, in) != 1)
+                break;
+            if (crc32(licensePlate.data(), licensePlate.size(), crc32(&header.plateLength, checked))
+                != header.checksum)
+                break;
+            uint64_t end = validBytes + sizeof(header) + header.plateLength;
+            if (!apply(header, licensePlate, basePosition + end - sizeof(fileHeader))) {
+                ok = false;
+                break;
+            }
+            validBytes = end;
+        }
+        fclose(in);
+        return ok;
+    }
+};
+
+//------------------------------------------------------
+// Snapshots.
+//
+// A snapshot is the whole lot in one file, laid out to be mapped and used
+// without parsing:
+//   - one array per Floor member (occupancy bitmaps, owner of each spot,
+//     type of each spot), for all floors back to back;
+//   - a table of parked vehicles;
+//   - their license plates as a FrozenPlates table, hash index included.
+// Owners are 1-based indexes into the vehicle table, and these become the
+// vehicle IDs of the restored lot. The floor arrays are copied into place
+// on load. The plate table is used in place, so restoring never hashes or
+// copies a plate into the interner. Sections are 8-byte aligned and
+// integers are in host byte order.
+const uint32_t kSnapshotVersion = 2;
+
+struct SnapshotHeader {
+    char magic[8];              // "PLOTSNAP"
+    uint32_t version;           // kSnapshotVersion
+    uint32_t headerSize;        // sizeof(SnapshotHeader)
+    uint32_t numFloors;
+    uint32_t spotsPerFloor;
+    uint64_t vehicleCount;
+    uint64_t logPosition;       // write-ahead log position the snapshot covers
+    uint64_t occupancyOffset;   // uint64_t[numFloors * wordsPerFloor]
+    uint64_t ownersOffset;      // VehicleId[numFloors * spotsPerFloor]
+    uint64_t typesOffset;       // uint8_t[numFloors * spotsPerFloor]
+    uint64_t vehiclesOffset;    // SnapshotVehicle[vehicleCount]
+    uint64_t plateOffsetsOffset;    // uint64_t[vehicleCount + 1], see FrozenPlates
+    uint64_t plateSlotsOffset;      // VehicleId[plateSlotCount]
+    uint64_t plateSlotCount;        // power of two, > vehicleCount
+    uint64_t platesOffset;      // plate bytes
+    uint64_t platesSize;
+    uint64_t fileSize;
+    uint32_t bodyChecksum;      // CRC-32 of the bytes after the header
+    uint32_t checksum;          // CRC-32 of the header bytes before this field
+};
+
+struct SnapshotVehicle {
+    int32_t floorNumber;
+    int32_t firstSpot;
+    uint8_t type;
+    uint8_t spotCount;
+    uint16_t reserved;
+};
+static_assert(sizeof(SnapshotVehicle) == 12, "snapshot vehicle entry must stay packed");
+
+static const char kSnapshotMagic[8] = {'P', 'L', 'O', 'T', 'S', 'N', 'A', 'P'};
+
+// A snapshot file mapped read-only. open() checks the whole file (checksums, layout,
+// plate index, and that the bitmaps, owners and vehicle table agree), so a
+// lot restored from it is always self-consistent.
+class SnapshotFile {
+    int fd;
+    const char* data;
+    size_t size;
+
+    template <typename T>
+    const T* at(uint64_t offset) const {
+        return reinterpret_cast<const T*>(data + offset);
+    }
+
+    bool validate() const {
+        const SnapshotHeader& h = header();
+        uint64_t spots = (uint64_t)h.numFloors * h.spotsPerFloor;
+        uint64_t words = (uint64_t)h.numFloors * wordsPerFloor();
+        auto fits = [&](uint64_t offset, uint64_t bytes) {
+            return offset % 8 == 0 && offset <= size && bytes <= size - offset;
+        };
+        if (!fits(h.occupancyOffset, words * 8) || !fits(h.ownersOffset, spots * sizeof(VehicleId))
+            || !fits(h.typesOffset, spots) || h.vehicleCount > spots
+            || !fits(h.vehiclesOffset, h.vehicleCount * sizeof(SnapshotVehicle))
+            || !fits(h.plateOffsetsOffset, (h.vehicleCount + 1) * sizeof(uint64_t))
+            || h.plateSlotCount <= h.vehicleCount || (h.plateSlotCount & (h.plateSlotCount - 1)) != 0
+            || !fits(h.plateSlotsOffset, h.plateSlotCount * sizeof(VehicleId))
+            || !fits(h.platesOffset, h.platesSize))
+            return false;
+
+        // Plates: offsets ascend through the pool, the index holds valid IDs
+        // only, one per vehicle, and every plate is found under its own ID
+        // (so none repeats).
+        const uint64_t* offsets = at<uint64_t>(h.plateOffsetsOffset);
+        if (offsets[0] != 0 || offsets[h.vehicleCount] != h.platesSize)
+            return false;
+        for (uint64_t i = 0; i < h.vehicleCount; ++i)
+            if (offsets[i] > offsets[i + 1])
+                return false;
+        const VehicleId* slots = at<VehicleId>(h.plateSlotsOffset);
+        uint64_t usedSlots = 0;
+        for (uint64_t i = 0; i < h.plateSlotCount; ++i) {
+            if (slots[i] > h.vehicleCount)
+                return false;
+            usedSlots += slots[i] != kNoVehicle;
+        }
+        if (usedSlots != h.vehicleCount)
+            return false;
+        FrozenPlates plates = frozenPlates();
+        for (VehicleId id = 1; id <= h.vehicleCount; ++id)
+            if (plates.find(plates.plate(id)) != id)
+                return false;
+
+        // Each spot is occupied exactly when it has an owner.
+        for (uint32_t f = 0; f < h.numFloors; ++f) {
+            const uint64_t* bits = occupancy(f);
+            const VehicleId* owner = owners(f);
+            for (uint32_t s = 0; s < h.spotsPerFloor; ++s) {
+                bool occupied = (bits[s / 64] >> (s % 64)) & 1;
+                if (occupied != (owner[s] != kNoVehicle) || owner[s] > h.vehicleCount)
+                    return false;
+            }
+        }
+        // Each vehicle owns exactly the consecutive spots its entry lists,
+        // and they carry its type.
+        vector<uint32_t> owned(h.vehicleCount + 1, 0);
+        for (uint32_t f = 0; f < h.numFloors; ++f)
+            for (uint32_t s = 0; s < h.spotsPerFloor; ++s)
+                owned[owners(f)[s]]++;
+        for (uint64_t i = 0; i < h.vehicleCount; ++i) {
+            const SnapshotVehicle& v = vehicles()[i];
+            VehicleId id = (VehicleId)(i + 1);
+            if (v.type > (uint8_t)VehicleType::Truck || v.spotCount < 1
+                || v.spotCount > kMaxSpotsPerVehicle || owned[id] != v.spotCount
+                || Vehicle(string(), (VehicleType)v.type).getRequiredSpots() != v.spotCount
+                || v.floorNumber < 0 || (uint32_t)v.floorNumber >= h.numFloors || v.firstSpot < 0
+                || (uint64_t)v.firstSpot + v.spotCount > h.spotsPerFloor)
+                return false;
+            for (int k = v.firstSpot; k < v.firstSpot + v.spotCount; ++k)
+                if (owners(v.floorNumber)[k] != id || types(v.floorNumber)[k] != v.type)
+                    return false;
+        }
+        return true;
+    }
+
+public:
+    SnapshotFile() : fd(-1), data(nullptr), size(0) {}
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    ~SnapshotFile() {
+        if (data != nullptr)
+            ::munmap(const_cast<char*>(data), size);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    // Reads and checks just the header of the snapshot at `path`.
+    static bool readHeader(const string& path, SnapshotHeader& header) {
+        FILE* in = fopen(path.c_str(), "rb");
+        if (in == nullptr)
+            return false;
+        bool ok = fread(&header, sizeof(header), 1, in) == 1;
+        fclose(in);
+        return ok && memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0
+            && header.version == kSnapshotVersion && header.headerSize == sizeof(SnapshotHeader)
+            && header.checksum == crc32(&header, offsetof(SnapshotHeader, checksum))
+            && header.numFloors <= (1u << 20) && header.spotsPerFloor <= (1u << 30);
+    }
+
+    // Maps the snapshot at `path`. Returns false if it cannot be read or is
+    // not a valid snapshot.
+    bool open(const string& path) {
+        SnapshotHeader h;
+        if (!readHeader(path, h))
+            return false;
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0 || (uint64_t)st.st_size != h.fileSize)
+            return false;
+        size = st.st_size;
+        void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+            return false;
+        data = static_cast<const char*>(mapped);
+        return memcmp(data, &h, sizeof(h)) == 0
+            && crc32(data + sizeof(h), size - sizeof(h)) == h.bodyChecksum && validate();
+    }
+
+    const SnapshotHeader& header() const { return *at<SnapshotHeader>(0); }
+
+    uint32_t wordsPerFloor() const { return (header().spotsPerFloor + 63) / 64; }
+
+    const uint64_t* occupancy(int floor) const {
+        return at<uint64_t>(header().occupancyOffset) + (size_t)floor * wordsPerFloor();
+    }
+
+    const VehicleId* owners(int floor) const {
+        return at<VehicleId>(header().ownersOffset) + (size_t)floor * header().spotsPerFloor;
+    }
+
+    const uint8_t* types(int floor) const {
+        return at<uint8_t>(header().typesOffset) + (size_t)floor * header().spotsPerFloor;
+    }
+
+    const SnapshotVehicle* vehicles() const { return at<SnapshotVehicle>(header().vehiclesOffset); }
+
+    // The plates, for use in place; valid while this file is open.
+    FrozenPlates frozenPlates() const {
+        FrozenPlates plates;
+        plates.pool = at<char>(header().platesOffset);
+        plates.offsets = at<uint64_t>(header().plateOffsetsOffset);
+        plates.slots = at<VehicleId>(header().plateSlotsOffset);
+        plates.slotMask = header().plateSlotCount - 1;
+        plates.count = (uint32_t)header().vehicleCount;
+        return plates;
+    }
+};
+
+//------------------------------------------------------
+// Where a parked vehicle is. A floor number of -1 marks a reservation for a
+// park that is still searching for spots. The vehicle itself needs no copy:
+// its ID gives the plate (PlateInterner) and its spots hold its type.
+struct VehicleLocation {
+    int floorNumber;
+    SpotList spots;
+};
+
+// FlatLocationMap: open-addressing hash table from VehicleId to
+// VehicleLocation, with linear probing and backward-shift deletion (no
+// tombstones). Entries live inline in one array, so a lookup usually touches
+// a single cache line and inserts allocate only when the table grows.
+class FlatLocationMap {
+    struct Entry {
+        VehicleId key;          // kNoVehicle marks an empty slot
+        VehicleLocation value;
+    };
+
+    vector<Entry> table;
+    size_t mask;
+    size_t count;
+
+    size_t home(VehicleId key) const {
+        // Fibonacci hashing; IDs in one shard share low bits, so use the high ones.
+        return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    }
+
+    void grow() {
+        vector<Entry> old;
+        old.swap(table);
+        table.assign(old.size() * 2, Entry{kNoVehicle, VehicleLocation()});
+        mask = table.size() - 1;
+        for (auto& entry : old) {
+            if (entry.key == kNoVehicle)
+                continue;
+            size_t i = home(entry.key);
+            while (table[i].key != kNoVehicle)
+                i = (i + 1) & mask;
+            table[i] = entry;
+        }
+    }
+
+public:
+    explicit FlatLocationMap(size_t initialCapacity = 64) : count(0) {
+        size_t size = 8;
+        while (size < initialCapacity)
+            size *= 2;
+        table.assign(size, Entry{kNoVehicle, VehicleLocation()});
+        mask = size - 1;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // Grow the table up front so `expected` entries fit without rehashing.
+    void reserve(size_t expected) {
+        size_t size = table.size();
+        while (expected * 4 > size * 3)
+            size *= 2;
+        if (size == table.size())
+            return;
+        if (count == 0) {
+            table.assign(size, Entry{kNoVehicle, VehicleLocation()});
+            mask = size - 1;
+        }
+        while (table.size() < size)
+            grow();
+    }
+
+    VehicleLocation* find(VehicleId key) {
+        for (size_t i = home(key);; i = (i + 1) & mask) {
+            if (table[i].key == key)
+                return &table[i].value;
+            if (table[i].key == kNoVehicle)
+                return nullptr;
+        }
+    }
+
+    // Returns the entry for `key`, inserting a default one if absent.
+    VehicleLocation& operator[](VehicleId key) {
+        if ((count + 1) * 4 > table.size() * 3)
+            grow();
+        size_t i = home(key);
+        while (table[i].key != kNoVehicle && table[i].key != key)
+            i = (i + 1) & mask;
+        if (table[i].key == kNoVehicle) {
+            table[i].key = key;
+            table[i].value = VehicleLocation();
+            ++count;
+        }
+        return table[i].value;
+    }
+
+    bool erase(VehicleId key) {
+        size_t i = home(key);
+        while (table[i].key != key) {
+            if (table[i].key == kNoVehicle)
+                return false;
+            i = (i + 1) & mask;
+        }
+        // Shift later members of the probe run back into the hole.
+        for (size_t j = (i + 1) & mask; table[j].key != kNoVehicle; j = (j + 1) & mask) {
+            size_t h = home(table[j].key);
+            // Move j into i unless its home lies cyclically in (i, j].
+            bool inRange = (i <= j) ? (i < h && h <= j) : (i < h || h <= j);
+            if (!inRange) {
+                table[i] = table[j];
+                i = j;
+            }
+        }
+        table[i].key = kNoVehicle;
+        --count;
+        return true;
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (auto& entry : table)
+            if (entry.key != kNoVehicle)
+                fn(entry.key, entry.value);
+    }
+};
+
+//------------------------------------------------------
+// ParkingLot Class: Manages all floors and global operations.
+//
+// Locking: every Floor has its own mutex guarding its spots (or, under
+// ClaimMode::AtomicBitmap, claims spots with CAS and uses the mutex only to
+// take the whole floor), and the vehicle index is split into shards, each
+// with its own mutex. A thread only ever takes a shard lock and then
+// (optionally) one floor, never the other way round.
+class ParkingLot {
+private:
+    // One shard of the vehicle index, selected by vehicle ID.
+    struct LocationShard {
+        mutex mtx;
+        // Maps: vehicleId -> (floorNumber, spotNumbers).
+        FlatLocationMap vehicleLocations;
+    };
+
+    static const int kLocationShards = 64;
+    LocationShard shards[kLocationShards];
+
+    // Free spots across all floors, kept in step with the per-floor counters.
+    atomic<long long> totalFreeSpots;
+
+    // Optional event consumer; not owned.
+    EventSink* eventSink;
+
+    // Publish the outcome of an operation to the sink (if any) and return it.
+    ParkingResult report(const string& licensePlate, ParkingResult result) {
+        if (eventSink != nullptr) {
+            ParkingEvent event{result.status, licensePlate, result.floorNumber,
+                               result.spots.empty() ? -1 : result.spots.front(),
+                               (int)result.spots.size()};
+            eventSink->publish(event);
+        }
+        return result;
+    }
+
+    // Optional durability log; not owned. Each change is appended while the
+    // floor it touches is held (FloorWriteGuard), after taking spots and
+    // before freeing them, so the log orders changes to a spot exactly as
+    // they happened.
+    WriteAheadLog* writeAheadLog;
+
+    // The snapshot recovery starts from. Only a snapshot written here may
+    // checkpoint the log; one written anywhere else is just a copy.
+    string snapshotPath;
+
+    // Log a park/removal; returns the position to wait for (0 if no log).
+    uint64_t logPark(const Vehicle& vehicle, int floorNumber, const SpotList& spots) {
+        if (writeAheadLog == nullptr)
+            return 0;
+        return writeAheadLog->append(WalOp::Park, vehicle.licensePlate, vehicle.type,
+                                     floorNumber, spots.front());
+    }
+
+    uint64_t logRemove(const string& licensePlate, int floorNumber, const SpotList& spots) {
+        if (writeAheadLog == nullptr)
+            return 0;
+        return writeAheadLog->append(WalOp::Remove, licensePlate, VehicleType::Bike,
+                                     floorNumber, spots.front());
+    }
+
+    // Block until logged changes up to `position` are durable (per
+    // FsyncPolicy). Returns false if the log failed before they were.
+    bool waitDurable(uint64_t position) {
+        return writeAheadLog == nullptr || writeAheadLog->waitDurable(position);
+    }
+
+    // License plate <-> vehicle ID mapping; plates are hashed only here.
+    PlateInterner plates;
+
+    LocationShard& shardFor(VehicleId id) {
+        return shards[id % kLocationShards];
+    }
+
+    // Where each parked vehicle is, by vehicle ID, for findVehicle: one word
+    // per ID packing the spot count, floor and first spot (0 = not parked).
+    // Written under the vehicle's shard lock; read without any lock. A
+    // location is published once the park is committed and withdrawn before
+    // a removal frees its spots, so a reader never sees two vehicles in one
+    // spot.
+    ChunkedArray<atomic<uint64_t>> publishedLocations;
+
+    void publishLocation(VehicleId id, int floorNumber, const SpotList& spots) {
+        uint64_t word = 1ULL << 63 | (uint64_t)spots.size() << 60 | (uint64_t)floorNumber << 32
+                        | (uint32_t)spots.front();
+        publishedLocations.at(id).store(word, memory_order_release);
+    }
+
+    void withdrawLocation(VehicleId id) {
+        publishedLocations.at(id).store(0, memory_order_release);
+    }
+
+    uint64_t publishedLocation(VehicleId id) const {
+        const atomic<uint64_t>* word = publishedLocations.find(id);
+        return word == nullptr ? 0 : word->load(memory_order_acquire);
+    }
+
+    // How spots are chosen on each floor.
+    AllocationPolicy policy;
+
+    // Snapshot this lot was restored from, if any; kept mapped because the
+    // interner reads its plates in place.
+    shared_ptr<const SnapshotFile> snapshotBase;
+
+    // Lot-wide summary of which floors can take a vehicle, one bit per floor:
+    // floorsWithSpot for any free spot, floorsWithRun for two or more
+    // consecutive free spots. Bits are refreshed under the floor's lock after
+    // every change, so parkVehicle visits only floors that may fit and never
+    // touches a full one.
+    vector<atomic<uint64_t>> floorsWithSpot;
+    vector<atomic<uint64_t>> floorsWithRun;
+
+    static void setFloorBit(vector<atomic<uint64_t>>& mask, int floorNumber, bool set) {
+        uint64_t bit = 1ULL << (floorNumber % 64);
+        if (set)
+            mask[floorNumber / 64].fetch_or(bit);
+        else
+            mask[floorNumber / 64].fetch_and(~bit);
+    }
+
+    // Refresh a floor's summary bits. Caller holds the floor (FloorWriteGuard).
+    // AtomicBitmap floors have no run index and several writers at once, so
+    // both bits follow the free counter (two free spots may fit a Truck), and
+    // are re-derived until the counter is unchanged after writing them: a
+    // writer that changes it later refreshes the bits itself.
+    void updateFloorIndex(const Floor* floor) {
+        if (!floor->atomicClaims) {
+            setFloorBit(floorsWithSpot, floor->floorNumber, floor->availableSpotsCount() > 0);
+            setFloorBit(floorsWithRun, floor->floorNumber, floor->freeRuns.longestRun() >= 2);
+            return;
+        }
+        int freeSpots;
+        do {
+            freeSpots = floor->freeSpots.load();
+            setFloorBit(floorsWithSpot, floor->floorNumber, freeSpots > 0);
+            setFloorBit(floorsWithRun, floor->floorNumber, freeSpots >= 2);
+        } while (floor->freeSpots.load() != freeSpots);
+    }
+
+    // Calls fn(floor) for each floor that may fit `required` spots, in floor
+    // order, until fn returns true. Returns whether it did.
+    template <typename Fn>
+    bool forEachCandidateFloor(int required, Fn fn) {
+        const vector<atomic<uint64_t>>& mask = (required <= 1) ? floorsWithSpot : floorsWithRun;
+        for (size_t w = 0; w < mask.size(); ++w) {
+            for (uint64_t bits = mask[w].load(memory_order_acquire); bits != 0; bits &= bits - 1) {
+                if (fn(floors[w * 64 + __builtin_ctzll(bits)]))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // Scoped permission to park on or remove from one floor: its lock for
+    // FloorLock floors; for AtomicBitmap floors, a place among activeWriters
+    // (or the lock, while Floor::lockExclusive is in progress).
+    class FloorWriteGuard {
+        Floor& floor;
+        bool locked;
+        bool entered;
+
+    public:
+        // With `wait` false, gives up instead of blocking on the lock.
+        explicit FloorWriteGuard(Floor& floor, bool wait = true) : floor(floor), locked(false) {
+            if (floor.atomicClaims) {
+                floor.activeWriters.fetch_add(1);
+                entered = !floor.quiescing.load();
+                if (entered)
+                    return;
+                floor.activeWriters.fetch_sub(1);
+            }
+            locked = entered = wait ? (lockCounted(floor.mtx), true) : floor.mtx.try_lock();
+        }
+        FloorWriteGuard(const FloorWriteGuard&) = delete;
+        FloorWriteGuard& operator=(const FloorWriteGuard&) = delete;
+
+        ~FloorWriteGuard() {
+            if (locked)
+                floor.mtx.unlock();
+            else if (entered)
+                floor.activeWriters.fetch_sub(1, memory_order_release);
+        }
+
+        bool ownsFloor() const { return entered; }
+    };
+
+    // Try to claim spots on one floor while holding it.
+    bool claimOnFloor(Floor* floor, const Vehicle* vehicle, VehicleId id, SpotList& spots,
+                      uint64_t& logPosition) {
+        if (!floor->claimSpots(id, vehicle, policy, 0, spots))
+            return false;
+        updateFloorIndex(floor);
+        logPosition = logPark(*vehicle, floor->floorNumber, spots);
+        return true;
+    }
+
+public:
+    // Store floors as pointers
+    vector<Floor*> floors;
+
+    // Constructor. BestFit always uses FloorLock claims.
+    ParkingLot(int numFloors, int spotsPerFloor, AllocationPolicy policy = AllocationPolicy::FirstFit,
+               ClaimMode claimMode = ClaimMode::FloorLock)
+        : totalFreeSpots((long long)max(numFloors, 0) * max(spotsPerFloor, 0)), eventSink(nullptr),
+          writeAheadLog(nullptr), policy(policy),
+          floorsWithSpot((numFloors + 63) / 64), floorsWithRun((numFloors + 63) / 64)
+    {
+        if (policy == AllocationPolicy::BestFit)
+            claimMode = ClaimMode::FloorLock;
+        for (int i = 0; i < numFloors; ++i) {
+            floors.push_back(new Floor(i, spotsPerFloor, claimMode));
+            updateFloorIndex(floors.back());
+        }
+    }
+
+    // Destructor to delete allocated Floor pointers
+    ~ParkingLot() {
+        for (auto* floor : floors) {
+            delete floor;
+        }
+        floors.clear();
+    }
+
+    // Route operation events to `sink` (nullptr to disable). Call before traffic starts.
+    void setEventSink(EventSink* sink) {
+        eventSink = sink;
+    }
+
+    // Log every change to `log` (nullptr to disable). Call before traffic
+    // starts, after any recovery.
+    void setWriteAheadLog(WriteAheadLog* log) {
+        writeAheadLog = log;
+    }
+
+    // The snapshot file recovery reads (empty if none). saveSnapshot() to
+    // this path checkpoints the write-ahead log.
+    void setSnapshotPath(const string& path) {
+        snapshotPath = path;
+    }
+
+    const string& getSnapshotPath() const {
+        return snapshotPath;
+    }
+
+    // Park a vehicle. The lot keeps no Vehicle object: the plate is interned
+    // once and the type is stored in the spots, so nothing is allocated per
+    // park once a plate has been seen. Returns Parked with the floor and
+    // spots on success.
+    ParkingResult parkVehicle(const string& licensePlate, VehicleType type) {
+        return parkVehicle(Vehicle(licensePlate, type));
+    }
+
+    ParkingResult parkVehicle(const Vehicle& vehicle) {
+        OperationTimer timer(StatOp::Park);
+        VehicleId id = plates.intern(vehicle.licensePlate);
+        if (id == kNoVehicle)
+            return timer.finish(report(vehicle.licensePlate, ParkingResult(ParkingStatus::NoSpace)));
+        LocationShard& shard = shardFor(id);
+
+        // Check if vehicle is already parked, and reserve the plate so a
+        // concurrent park of the same vehicle is rejected.
+        {
+            unique_lock<mutex> lock = lockCountedGuard(shard.mtx);
+            if (shard.vehicleLocations.find(id) != nullptr)
+                return timer.finish(report(vehicle.licensePlate, ParkingResult(ParkingStatus::AlreadyParked)));
+            shard.vehicleLocations[id].floorNumber = -1;
+        }
+
+        // Visit the floors that may fit the vehicle. Floors busy with another
+        // gate are skipped on the first pass; if that finds nothing, a second
+        // pass waits for each candidate floor in turn.
+        Floor* parkedFloor = nullptr;
+        SpotList availableSpots;
+        bool skippedBusyFloor = false;
+        uint64_t logPosition = 0;
+        int required = vehicle.getRequiredSpots();
+        forEachCandidateFloor(required, [&](Floor* floor) {
+            FloorWriteGuard guard(*floor, false);
+            if (!guard.ownsFloor()) {
+                skippedBusyFloor = true;
+                return false;
+            }
+            if (!claimOnFloor(floor, &vehicle, id, availableSpots, logPosition))
+                return false;
+            parkedFloor = floor;
+            return true;
+        });
+        if (parkedFloor == nullptr && skippedBusyFloor) {
+            forEachCandidateFloor(required, [&](Floor* floor) {
+                FloorWriteGuard guard(*floor);
+                if (!claimOnFloor(floor, &vehicle, id, availableSpots, logPosition))
+                    return false;
+                parkedFloor = floor;
+                return true;
+            });
+        }
+
+        {
+            unique_lock<mutex> lock = lockCountedGuard(shard.mtx);
+            if (parkedFloor == nullptr) {
+                shard.vehicleLocations.erase(id);
+            } else {
+                totalFreeSpots.fetch_sub(availableSpots.size(), memory_order_relaxed);
+                // Save location: (floorNumber, spotNumbers)
+                VehicleLocation& location = *shard.vehicleLocations.find(id);
+                location.floorNumber = parkedFloor->floorNumber;
+                location.spots = availableSpots;
+                publishLocation(id, location.floorNumber, availableSpots);
+            }
+        }
+
+        if (parkedFloor == nullptr)
+            return timer.finish(report(vehicle.licensePlate, ParkingResult(ParkingStatus::NoSpace)));
+        ParkingResult result(ParkingStatus::Parked, parkedFloor->floorNumber, availableSpots);
+        result.logFailed = !waitDurable(logPosition);
+        return timer.finish(report(vehicle.licensePlate, result));
+    }
+
+    // Park many vehicles at once, e.g. at a shift change. Equivalent to calling
+    // parkVehicle for each in order, but each floor is locked once for the
+    // whole batch and single-spot searches resume where the previous vehicle
+    // was placed instead of restarting at spot 0. Returns one result per vehicle.
+    vector<ParkingResult> parkVehicles(const vector<Vehicle>& vehicles) {
+        vector<ParkingResult> results(vehicles.size(), ParkingResult(ParkingStatus::NoSpace));
+        vector<VehicleId> ids(vehicles.size(), kNoVehicle);
+
+        // Reserve every plate that is not already parked.
+        vector<size_t> pending;
+        for (size_t i = 0; i < vehicles.size(); ++i) {
+            ids[i] = plates.intern(vehicles[i].licensePlate);
+            if (ids[i] == kNoVehicle)
+                continue;   // out of IDs: stays NoSpace
+            LocationShard& shard = shardFor(ids[i]);
+            unique_lock<mutex> lock = lockCountedGuard(shard.mtx);
+            if (shard.vehicleLocations.find(ids[i]) != nullptr) {
+                results[i] = ParkingResult(ParkingStatus::AlreadyParked);
+                ids[i] = kNoVehicle;
+                continue;
+            }
+            shard.vehicleLocations[ids[i]].floorNumber = -1;
+            pending.push_back(i);
+        }
+
+        // Fill floors in order; whatever does not fit moves on to the next floor.
+        vector<size_t> remaining;
+        uint64_t logPosition = 0;
+        forEachCandidateFloor(1, [&](Floor* floor) {
+            FloorWriteGuard guard(*floor);
+            int singleHint = 0;   // first-fit only: every spot below this is taken
+            remaining.clear();
+            for (size_t i : pending) {
+                SpotList spots;
+                if (floor->claimSpots(ids[i], &vehicles[i], policy, singleHint, spots)) {
+                    if (spots.size() == 1 && policy == AllocationPolicy::FirstFit)
+                        singleHint = spots.front() + 1;
+                    results[i] = ParkingResult(ParkingStatus::Parked, floor->floorNumber, spots);
+                    logPosition = logPark(vehicles[i], floor->floorNumber, spots);
+                } else {
+                    remaining.push_back(i);
+                }
+            }
+            updateFloorIndex(floor);
+            pending.swap(remaining);
+            return pending.empty();
+        });
+        bool logFailed = !waitDurable(logPosition);
+
+        // Record locations (or drop reservations) and report.
+        for (size_t i = 0; i < vehicles.size(); ++i) {
+            results[i].logFailed = logFailed && results[i].status == ParkingStatus::Parked;
+            countOutcome(StatOp::Park, results[i].status);
+            if (ids[i] == kNoVehicle) {
+                report(vehicles[i].licensePlate, results[i]);
+                continue;
+            }
+            LocationShard& shard = shardFor(ids[i]);
+            {
+                unique_lock<mutex> lock = lockCountedGuard(shard.mtx);
+                if (results[i].status != ParkingStatus::Parked) {
+                    shard.vehicleLocations.erase(ids[i]);
+                } else {
+                    totalFreeSpots.fetch_sub(results[i].spots.size(), memory_order_relaxed);
+                    VehicleLocation& location = *shard.vehicleLocations.find(ids[i]);
+                    location.floorNumber = results[i].floorNumber;
+                    location.spots = results[i].spots;
+                    publishLocation(ids[i], location.floorNumber, location.spots);
+                }
+            }
+            report(vehicles[i].licensePlate, results[i]);
+        }
+        return results;
+    }
+
+    // Remove many vehicles at once. Each vehicle's index entry is first
+    // reserved (floorNumber -1, as during a park), then its removal is logged
+    // and its spots freed floor by floor, with each floor locked once for the
+    // whole batch, and only then is the entry dropped. Until that point a park
+    // of the same plate is rejected as AlreadyParked, so the log never holds
+    // its Park before this Remove. Returns one result per license plate.
+    vector<ParkingResult> removeVehicles(const vector<string>& licensePlates) {
+        vector<ParkingResult> results(licensePlates.size(), ParkingResult(ParkingStatus::NotFound));
+        vector<pair<int, size_t>> byFloor;   // (floorNumber, index into licensePlates)
+        vector<VehicleId> ids(licensePlates.size(), kNoVehicle);
+
+        for (size_t i = 0; i < licensePlates.size(); ++i) {
+            VehicleId id = plates.find(licensePlates[i]);
+            if (id == kNoVehicle)
+                continue;
+            LocationShard& shard = shardFor(id);
+            unique_lock<mutex> lock = lockCountedGuard(shard.mtx);
+            VehicleLocation* location = shard.vehicleLocations.find(id);
+            if (location == nullptr || location->floorNumber < 0)
+                continue;
+            results[i] = ParkingResult(ParkingStatus::Removed, location->floorNumber, location->spots);
+            ids[i] = id;
+            byFloor.push_back({location->floorNumber, i});
+            withdrawLocation(id);
+            location->floorNumber = -1;
+        }
+
+        sort(byFloor.begin(), byFloor.end());
+        uint64_t logPosition = 0;
+        for (size_t k = 0; k < byFloor.size();) {
+            Floor* floor = floors[byFloor[k].first];
+            FloorWriteGuard guard(*floor);
+            for (; k < byFloor.size() && floors[byFloor[k].first] == floor; ++k) {
+                const ParkingResult& result = results[byFloor[k].second];
+                logPosition = logRemove(licensePlates[byFloor[k].second], floor->floorNumber, result.spots);
+                floor->removeVehicle(ids[byFloor[k].second], result.spots);
+                totalFreeSpots.fetch_add(result.spots.size(), memory_order_relaxed);
+            }
+            updateFloorIndex(floor);
+        }
+
+        for (size_t i = 0; i < licensePlates.size(); ++i) {
+            if (ids[i] == kNoVehicle)
+                continue;
+            LocationShard& shard = shardFor(ids[i]);
+            unique_lock<mutex> lock = lockCountedGuard(shard.mtx);
+            shard.vehicleLocations.erase(ids[i]);
+        }
+        bool logFailed = !waitDurable(logPosition);
+
+        for (size_t i = 0; i < licensePlates.size(); ++i) {
+            results[i].logFailed = logFailed && results[i].status == ParkingStatus::Removed;
+            countOutcome(StatOp::Remove, results[i].status);
+            report(licensePlates[i], results[i]);
+        }
+        return results;
+    }
+
+    // Remove a vehicle based on license plate. Returns Removed with the freed
+    // floor and spots, or NotFound.
+    ParkingResult removeVehicle(const string& licensePlate) {
+        OperationTimer timer(StatOp::Remove);
+        VehicleId id = plates.find(licensePlate);
+        if (id == kNoVehicle)
+            return timer.finish(report(licensePlate, ParkingResult(ParkingStatus::NotFound)));
+        LocationShard& shard = shardFor(id);
+        unique_lock<mutex> lock = lockCountedGuard(shard.mtx);
+
+        VehicleLocation* location = shard.vehicleLocations.find(id);
+        if (location == nullptr || location->floorNumber < 0) {
+            lock.unlock();
+            return timer.finish(report(licensePlate, ParkingResult(ParkingStatus::NotFound)));
+        }
+        int floorNumber = location->floorNumber;
+        SpotList spots = location->spots;
+        // Remove from floor.
+        bool removed;
+        uint64_t logPosition = 0;
+        {
+            Floor* floor = floors[floorNumber];
+            FloorWriteGuard guard(*floor);
+            removed = floor->spotsOccupied(spots);
+            if (removed) {
+                withdrawLocation(id);
+                logPosition = logRemove(licensePlate, floorNumber, spots);
+                floor->removeVehicle(id, spots);
+                updateFloorIndex(floor);
+            }
+        }
+        if (!removed) {
+            lock.unlock();
+            return timer.finish(report(licensePlate, ParkingResult(ParkingStatus::NotFound)));
+        }
+
+        totalFreeSpots.fetch_add(spots.size(), memory_order_relaxed);
+        shard.vehicleLocations.erase(id);
+        lock.unlock();
+        ParkingResult result(ParkingStatus::Removed, floorNumber, spots);
+        result.logFailed = !waitDurable(logPosition);
+        return timer.finish(report(licensePlate, result));
+    }
+
+    // Park a vehicle in exactly the given spots, as recorded in a write-ahead
+    // log. Used by recovery: nothing is logged or reported. Returns false if
+    // the plate is already parked or the spots are not free on this lot.
+    bool restoreParked(const Vehicle& vehicle, int floorNumber, int firstSpot) {
+        if (floorNumber < 0 || floorNumber >= (int)floors.size())
+            return false;
+        SpotList spots;
+        for (int i = 0; i < vehicle.getRequiredSpots() && i < kMaxSpotsPerVehicle; ++i)
+            spots.push_back(firstSpot + i);
+
+        VehicleId id = plates.intern(vehicle.licensePlate);
+        if (id == kNoVehicle)
+            return false;
+        LocationShard& shard = shardFor(id);
+        lock_guard<mutex> lock(shard.mtx);
+        if (spots.empty() || shard.vehicleLocations.find(id) != nullptr)
+            return false;
+        {
+            Floor* floor = floors[floorNumber];
+            FloorWriteGuard guard(*floor);
+            if (!floor->parkVehicle(id, vehicle.type, spots))
+                return false;
+            updateFloorIndex(floor);
+        }
+        totalFreeSpots.fetch_sub(spots.size(), memory_order_relaxed);
+        VehicleLocation& location = shard.vehicleLocations[id];
+        location.floorNumber = floorNumber;
+        location.spots = spots;
+        publishLocation(id, floorNumber, spots);
+        return true;
+    }
+
+    // Remove the vehicle a write-ahead log records leaving from `firstSpot` on
+    // `floorNumber`. Used by recovery: nothing is logged or reported. Returns
+    // false unless `licensePlate` is parked there and owns those spots.
+    bool restoreRemoved(const string& licensePlate, int floorNumber, int firstSpot) {
+        VehicleId id = plates.find(licensePlate);
+        if (id == kNoVehicle)
+            return false;
+        LocationShard& shard = shardFor(id);
+        lock_guard<mutex> lock(shard.mtx);
+        VehicleLocation* location = shard.vehicleLocations.find(id);
+        if (location == nullptr || location->floorNumber != floorNumber || location->spots.front() != firstSpot)
+            return false;
+        {
+            Floor* floor = floors[floorNumber];
+            FloorWriteGuard guard(*floor);
+            if (!floor->spotsOccupied(location->spots) || floor->spot(firstSpot).parkedVehicle() != id)
+                return false;
+            withdrawLocation(id);
+            floor->removeVehicle(id, location->spots);
+            updateFloorIndex(floor);
+        }
+        totalFreeSpots.fetch_add(location->spots.size(), memory_order_relaxed);
+        shard.vehicleLocations.erase(id);
+        return true;
+    }
+
+    // Write the whole lot to a snapshot file at `path` (via a temporary file
+    // and rename, so a crash leaves the previous snapshot intact). Floors are
+    // copied with every floor held exclusively, which also pins the write-ahead log
+    // at an exact cut: once the snapshot is durable, and if `path` is the
+    // lot's own snapshot path, the log is checkpointed up to that point. A
+    // snapshot anywhere else leaves the log whole, as recovery never reads it.
+    // Parks still being committed are included, as their log records precede
+    // the cut. Returns false on I/O errors.
+    bool saveSnapshot(const string& path) {
+        uint32_t numFloors = floors.size();
+        uint32_t spotsPerFloor = floors.empty() ? 0 : floors[0]->spotCount();
+        size_t wordsPerFloor = (spotsPerFloor + 63) / 64;
+        vector<uint64_t> occupancy(numFloors * wordsPerFloor);
+        vector<VehicleId> owners(numFloors * (size_t)spotsPerFloor);
+        vector<uint8_t> types(owners.size());
+        uint64_t logPosition = 0;
+        {
+            for (auto* floor : floors)
+                floor->lockExclusive();
+            if (writeAheadLog != nullptr)
+                logPosition = writeAheadLog->position();
+            for (uint32_t f = 0; f < numFloors; ++f) {
+                for (size_t w = 0; w < wordsPerFloor; ++w)
+                    occupancy[f * wordsPerFloor + w] = floors[f]->occupancyWord(w);
+                copy(floors[f]->parkedVehicles.begin(), floors[f]->parkedVehicles.end(),
+                     owners.begin() + (size_t)f * spotsPerFloor);
+                copy(floors[f]->parkedTypes.begin(), floors[f]->parkedTypes.end(),
+                     types.begin() + (size_t)f * spotsPerFloor);
+            }
+            for (auto* floor : floors)
+                floor->unlockExclusive();
+        }
+
+        // Renumber owners into vehicle table indexes. A vehicle's spots are
+        // consecutive and on one floor, so each new run of an ID is a vehicle.
+        vector<SnapshotVehicle> vehicles;
+        vector<uint64_t> plateOffsets(1, 0);
+        string platePool;
+        for (uint32_t f = 0; f < numFloors; ++f) {
+            VehicleId previous = kNoVehicle;
+            for (uint32_t s = 0; s < spotsPerFloor; ++s) {
+                VehicleId& owner = owners[(size_t)f * spotsPerFloor + s];
+                VehicleId id = owner;
+                if (id == kNoVehicle) {
+                    previous = kNoVehicle;
+                    continue;
+                }
+                if (id != previous) {
+                    vehicles.push_back(SnapshotVehicle{(int32_t)f, (int32_t)s,
+                                                       types[(size_t)f * spotsPerFloor + s], 0, 0});
+                    platePool += plates.plate(id);
+                    plateOffsets.push_back(platePool.size());
+                }
+                vehicles.back().spotCount++;
+                owner = (VehicleId)vehicles.size();
+                previous = id;
+            }
+        }
+
+        // Hash index over the plates, at most half full.
+        size_t slotCount = 2;
+        while (slotCount < 2 * vehicles.size() + 1)
+            slotCount *= 2;
+        vector<VehicleId> plateSlots(slotCount, kNoVehicle);
+        for (size_t i = 0; i < vehicles.size(); ++i) {
+            string_view plate(platePool.data() + plateOffsets[i], plateOffsets[i + 1] - plateOffsets[i]);
+            size_t slot = plateHash(plate) & (slotCount - 1);
+            while (plateSlots[slot] != kNoVehicle)
+                slot = (slot + 1) & (slotCount - 1);
+            plateSlots[slot] = (VehicleId)(i + 1);
+        }
+
+        SnapshotHeader header = {};
+        memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+        header.version = kSnapshotVersion;
+        header.headerSize = sizeof(header);
+        header.numFloors = numFloors;
+        header.spotsPerFloor = spotsPerFloor;
+        header.vehicleCount = vehicles.size();
+        header.logPosition = logPosition;
+        vector<char> image(sizeof(header));
+        auto addSection = [&](const void* section, size_t bytes) {
+            image.resize((image.size() + 7) & ~(size_t)7);
+            uint64_t offset = image.size();
+            const char* raw = static_cast<const char*>(section);
+            image.insert(image.end(), raw, raw + bytes);
+            return offset;
+        };
+        header.occupancyOffset = addSection(occupancy.data(), occupancy.size() * sizeof(uint64_t));
+        header.ownersOffset = addSection(owners.data(), owners.size() * sizeof(VehicleId));
+        header.typesOffset = addSection(types.data(), types.size());
+        header.vehiclesOffset = addSection(vehicles.data(), vehicles.size() * sizeof(SnapshotVehicle));
+        header.plateOffsetsOffset = addSection(plateOffsets.data(), plateOffsets.size() * sizeof(uint64_t));
+        header.plateSlotsOffset = addSection(plateSlots.data(), plateSlots.size() * sizeof(VehicleId));
+        header.plateSlotCount = slotCount;
+        header.platesOffset = addSection(platePool.data(), platePool.size());
+        header.platesSize = platePool.size();
+        header.fileSize = image.size();
+        header.bodyChecksum = crc32(image.data() + sizeof(header), image.size() - sizeof(header));
+        header.checksum = crc32(&header, offsetof(SnapshotHeader, checksum));
+        memcpy(image.data(), &header, sizeof(header));
+
+        string tmpPath = path + ".tmp";
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        const char* data = image.data();
+        size_t left = image.size();
+        while (left > 0) {
+            ssize_t n = ::write(fd, data, left);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            data += n;
+            left -= n;
+        }
+        bool ok = left == 0 && ::fdatasync(fd) == 0;
+        ok = (::close(fd) == 0) && ok && ::rename(tmpPath.c_str(), path.c_str()) == 0;
+        if (!ok) {
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        syncParentDirectory(path);
+        if (writeAheadLog != nullptr && !snapshotPath.empty() && path == snapshotPath)
+            return writeAheadLog->discardBefore(logPosition);
+        return true;
+    }
+
+    // Load a snapshot into this lot, which must be freshly constructed with
+    // the snapshot's floor count and size. The floor arrays are copied
+    // straight from the mapped file and each run index is rebuilt in one pass.
+    // The plates are used in place, so the lot keeps the file mapped. Only
+    // the vehicle index is rebuilt entry by entry. Returns false, changing
+    // nothing, if the shapes differ or the lot has already been used.
+    bool restoreSnapshot(shared_ptr<const SnapshotFile> snapshot) {
+        const SnapshotHeader& header = snapshot->header();
+        if (header.numFloors != floors.size()
+            || (!floors.empty() && header.spotsPerFloor != (uint32_t)floors[0]->spotCount())
+            || plates.size() != 0 || header.vehicleCount > PlateInterner::kMaxId)
+            return false;
+
+        long long freeSpots = 0;
+        for (uint32_t f = 0; f < header.numFloors; ++f) {
+            Floor* floor = floors[f];
+            floor->lockExclusive();
+            floor->restore(snapshot->occupancy(f), snapshot->owners(f), snapshot->types(f));
+            updateFloorIndex(floor);
+            floor->unlockExclusive();
+            freeSpots += floor->availableSpotsCount();
+        }
+        totalFreeSpots.store(freeSpots, memory_order_relaxed);
+
+        // Vehicle i of the table has ID i + 1, matching the owners just
+        // copied into the floors.
+        FrozenPlates frozen = snapshot->frozenPlates();
+        plates.setFrozenPlates(frozen);
+        snapshotBase = snapshot;
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard.mtx);
+            shard.vehicleLocations.reserve(header.vehicleCount / kLocationShards + 1);
+        }
+        string licensePlate;
+        for (VehicleId id = 1; id <= header.vehicleCount; ++id) {
+            const SnapshotVehicle& entry = snapshot->vehicles()[id - 1];
+            licensePlate.assign(frozen.plate(id));
+            LocationShard& shard = shardFor(id);
+            lock_guard<mutex> lock(shard.mtx);
+            VehicleLocation& location = shard.vehicleLocations[id];
+            location.floorNumber = entry.floorNumber;
+            for (int k = 0; k < entry.spotCount; ++k)
+                location.spots.push_back(entry.firstSpot + k);
+            publishLocation(id, location.floorNumber, location.spots);
+        }
+        return true;
+    }
+
+    // Returns a vector of available spots count per floor. Reads the maintained
+    // counters only, so it never blocks the parking path.
+    vector<int> getAvailableSpotsPerFloor() const {
+        vector<int> available;
+        for (auto* floor : floors) {
+            available.push_back(floor->availableSpotsCount());
+        }
+        return available;
+    }
+
+    // Free spots across all floors. Wait-free.
+    long long freeSpotCount() const {
+        return totalFreeSpots.load(memory_order_relaxed);
+    }
+
+    // Checks if parking lot is full. Wait-free.
+    bool isFull() const {
+        return totalFreeSpots.load(memory_order_relaxed) <= 0;
+    }
+
+    // Finds the vehicle location given a license plate. Returns Found with the
+    // floor and spots, or NotFound. Takes no lock: the plate lookup and the
+    // published location are both read lock-free, so lookups never wait for
+    // (or slow down) parks and removes.
+    ParkingResult findVehicle(const string& licensePlate) {
+        OperationTimer timer(StatOp::Find);
+        VehicleId id = plates.find(licensePlate);
+        uint64_t word = (id == kNoVehicle) ? 0 : publishedLocation(id);
+        if (word == 0)
+            return timer.finish(report(licensePlate, ParkingResult(ParkingStatus::NotFound)));
+        SpotList spots;
+        for (int i = 0; i < (int)((word >> 60) & 7); ++i)
+            spots.push_back((int)(uint32_t)word + i);
+        return timer.finish(report(licensePlate,
+                                   ParkingResult(ParkingStatus::Found, (int)((word >> 32) & 0xFFFFFFF), spots)));
+    }
+
+    // Cross-checks the vehicle index against the floors: every recorded spot
+    // must be occupied by its own vehicle and no spot may be held twice.
+    // Intended for quiescent states (tests, stress runs), not the hot path.
+    bool verifyConsistency() {
+        vector<vector<int>> claimed(floors.size());
+        for (size_t f = 0; f < floors.size(); ++f)
+            claimed[f].assign(floors[f]->spotCount(), 0);
+
+        size_t indexedSpots = 0;
+        size_t publishedCount = 0;
+        bool consistent = true;
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard.mtx);
+            shard.vehicleLocations.forEach([&](VehicleId id, const VehicleLocation& location) {
+                if (location.floorNumber < 0)
+                    return;
+                uint64_t word = publishedLocation(id);
+                if ((int)((word >> 32) & 0xFFFFFFF) != location.floorNumber
+                    || (int)(uint32_t)word != location.spots.front())
+                    consistent = false;
+                ++publishedCount;
+                for (int s : location.spots) {
+                    ParkingSpot spot = floors[location.floorNumber]->spot(s);
+                    if (++claimed[location.floorNumber][s] > 1 || !spot.isOccupied()
+                        || spot.parkedVehicle() != id)
+                        consistent = false;
+                    ++indexedSpots;
+                }
+            });
+        }
+        // Nothing else may be published.
+        for (VehicleId id = 1; id <= plates.size(); ++id)
+            if (publishedLocation(id) != 0)
+                --publishedCount;
+        if (!consistent || publishedCount != 0)
+            return false;
+
+        size_t occupiedSpots = 0;
+        long long freeSpots = 0;
+        for (auto* floor : floors) {
+            floor->lockExclusive();
+            int scannedFree = 0;
+            for (int i = 0; i < floor->spotCount(); ++i)
+                if (!floor->isOccupied(i))
+                    scannedFree++;
+            bool counted = scannedFree == floor->availableSpotsCount();
+            floor->unlockExclusive();
+            if (!counted)
+                return false;
+            occupiedSpots += floor->spotCount() - scannedFree;
+            freeSpots += scannedFree;
+        }
+        return occupiedSpots == indexedSpots && freeSpots == totalFreeSpots.load();
+    }
+};
+
+//------------------------------------------------------
+// Sharded lot: floors split across threads that share nothing.
+//
+// Each shard is a ParkingLot of its own, holding a contiguous range of the
+// lot's floors, and only the shard's thread ever touches it. Gates map to
+// shards round-robin. A park is tried on its gate's shard first and, if that
+// shard is full, passed on to the next shard, and so on round the ring.
+// Shards never read each other's state: a request is one message that moves
+// from inbox to inbox, and the last shard to handle it answers it.
+//
+// Plates stay unique lot-wide through a directory split the same way: every
+// plate belongs to the shard picked by its hash, whose thread records which
+// shard holds the vehicle. A park goes directory -> gate's shard (-> next
+// shards) -> directory; a remove goes directory -> holding shard; a find is
+// answered by the directory alone.
+
+enum class ShardOp { Park, Remove, Find };
+
+struct ShardBatch;
+
+// One request to a ShardedLot, which is also the message passed between its
+// shards. Floor numbers in `result` are lot-wide.
+struct ShardRequest {
+    ShardOp op;
+    string licensePlate;
+    VehicleType type;       // Park only
+    ParkingResult result;   // set once answered
+
+    ShardRequest(ShardOp op, const string& licensePlate, VehicleType type = VehicleType::Car)
+        : op(op), licensePlate(licensePlate), type(type), result(ParkingStatus::NotFound) {}
+
+private:
+    friend class ShardedLot;
+    enum class Stage { Lookup, Place, Settle, Evict };
+    Stage stage = Stage::Lookup;
+    int directoryShard = 0;         // shard whose directory owns the plate
+    int gateShard = 0;              // first shard a park tries
+    int shardsTried = 0;
+    int holder = -1;                // shard the vehicle is (or was) parked on
+    ShardRequest* next = nullptr;   // inbox link
+    ShardBatch* batch = nullptr;
+};
+
+// Requests a gate is waiting on; the shard answering the last one wakes it.
+struct ShardBatch {
+    atomic<size_t> pending;
+    mutex mtx;
+    condition_variable answered;
+    bool finished = false;
+};
+
+class ShardedLot {
+    // Directory entry: where a plate's vehicle is parked (holder -1 while a
+    // park is still looking for space).
+    struct PlateRecord {
+        int holder;
+        ParkingResult placement;
+    };
+
+    struct Shard {
+        unique_ptr<ParkingLot> lot;
+        int firstFloor;
+        unordered_map<string, PlateRecord> directory;
+        atomic<long long> spilledIn{0};   // parks placed here from another gate's shard
+        // Inbox: a lock-free stack of requests, taken whole by the shard's thread.
+        alignas(64) atomic<ShardRequest*> inbox{nullptr};
+        atomic<bool> sleeping{false};
+        mutex mtx;                        // only for sleeping on `wake`
+        condition_variable wake;
+        thread runner;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    atomic<bool> stopping;
+
+    void send(int target, ShardRequest* request) {
+        Shard& shard = *shards[target];
+        ShardRequest* head = shard.inbox.load(memory_order_relaxed);
+        do {
+            request->next = head;
+        } while (!shard.inbox.compare_exchange_weak(head, request));
+        if (shard.sleeping.load()) {
+            lock_guard<mutex> lock(shard.mtx);
+            shard.wake.notify_one();
+        }
+    }
+
+    // Hand the answered request back to its gate. Returns -1 (no next shard).
+    static int answer(ShardRequest& request) {
+        ShardBatch* batch = request.batch;
+        if (batch->pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+            lock_guard<mutex> lock(batch->mtx);
+            batch->finished = true;
+            batch->answered.notify_one();
+        }
+        return -1;
+    }
+
+    // Runs one stage of a request on shard `self`; returns the shard that
+    // runs the next stage, or -1 once it has been answered.
+    int step(int self, ShardRequest& request) {
+        Shard& shard = *shards[self];
+        switch (request.stage) {
+        case ShardRequest::Stage::Lookup: {
+            auto it = shard.directory.find(request.licensePlate);
+            if (request.op == ShardOp::Park) {
+                if (it != shard.directory.end()) {
+                    request.result = ParkingResult(ParkingStatus::AlreadyParked);
+                    return answer(request);
+                }
+                shard.directory.emplace(request.licensePlate, PlateRecord{-1, ParkingResult(ParkingStatus::NotFound)});
+                request.stage = ShardRequest::Stage::Place;
+                request.shardsTried = 0;
+                return request.gateShard;
+            }
+            if (it == shard.directory.end() || it->second.holder < 0) {
+                request.result = ParkingResult(ParkingStatus::NotFound);
+                return answer(request);
+            }
+            if (request.op == ShardOp::Find) {
+                const ParkingResult& placement = it->second.placement;
+                request.result = ParkingResult(ParkingStatus::Found, placement.floorNumber, placement.spots);
+                return answer(request);
+            }
+            request.holder = it->second.holder;
+            shard.directory.erase(it);
+            request.stage = ShardRequest::Stage::Evict;
+            return request.holder;
+        }
+        case ShardRequest::Stage::Place: {
+            ParkingResult result = shard.lot->parkVehicle(request.licensePlate, request.type);
+            if (result.status == ParkingStatus::Parked) {
+                result.floorNumber += shard.firstFloor;
+                request.holder = self;
+                if (self != request.gateShard)
+                    shard.spilledIn.fetch_add(1, memory_order_relaxed);
+            } else if (++request.shardsTried < (int)shards.size()) {
+                return (self + 1) % shards.size();
+            } else {
+                result = ParkingResult(ParkingStatus::NoSpace);
+                request.holder = -1;
+            }
+            request.result = result;
+            request.stage = ShardRequest::Stage::Settle;
+            return request.directoryShard;
+        }
+        case ShardRequest::Stage::Settle: {
+            auto it = shard.directory.find(request.licensePlate);
+            if (request.holder < 0)
+                shard.directory.erase(it);
+            else
+                it->second = PlateRecord{request.holder, request.result};
+            return answer(request);
+        }
+        case ShardRequest::Stage::Evict:
+            request.result = shard.lot->removeVehicle(request.licensePlate);
+            if (request.result.floorNumber >= 0)
+                request.result.floorNumber += shard.firstFloor;
+            return answer(request);
+        }
+        return answer(request);
+    }
+
+    // Shard thread: takes the whole inbox, restores arrival order (it is a
+    // stack) and runs each request as far as it stays on this shard.
+    void shardLoop(int self) {
+        Shard& shard = *shards[self];
+        while (true) {
+            ShardRequest* stack = shard.inbox.exchange(nullptr, memory_order_acquire);
+            if (stack == nullptr) {
+                unique_lock<mutex> lock(shard.mtx);
+                shard.sleeping.store(true);
+                shard.wake.wait(lock, [&] { return shard.inbox.load() != nullptr || stopping.load(); });
+                shard.sleeping.store(false);
+                if (shard.inbox.load() == nullptr)
+                    return;
+                continue;
+            }
+            ShardRequest* queue = nullptr;
+            while (stack != nullptr) {
+                ShardRequest* next = stack->next;
+                stack->next = queue;
+                queue = stack;
+                stack = next;
+            }
+            while (queue != nullptr) {
+                ShardRequest* request = queue;
+                queue = queue->next;
+                int target;
+                while ((target = step(self, *request)) == self) {}
+                if (target >= 0)
+                    send(target, request);
+            }
+        }
+    }
+
+public:
+    // numShards shards of floorsPerShard floors each; shard s holds floors
+    // [s * floorsPerShard, (s + 1) * floorsPerShard).
+    ShardedLot(int numShards, int floorsPerShard, int spotsPerFloor,
+               AllocationPolicy policy = AllocationPolicy::FirstFit)
+        : stopping(false)
+    {
+        for (int s = 0; s < max(1, numShards); ++s) {
+            shards.emplace_back(new Shard());
+            shards.back()->lot.reset(new ParkingLot(floorsPerShard, spotsPerFloor, policy));
+            shards.back()->firstFloor = s * floorsPerShard;
+        }
+        for (size_t s = 0; s < shards.size(); ++s)
+            shards[s]->runner = thread(&ShardedLot::shardLoop, this, s);
+    }
+
+    // Stops the shard threads. No request may be in flight.
+    ~ShardedLot() {
+        stopping.store(true);
+        for (auto& shard : shards) {
+            {
+                lock_guard<mutex> lock(shard->mtx);
+                shard->wake.notify_one();
+            }
+            shard->runner.join();
+        }
+    }
+
+    int shardCount() const {
+        return shards.size();
+    }
+
+    // Shard whose floors a park arriving at `gate` tries first.
+    int shardForGate(int gate) const {
+        return gate % shards.size();
+    }
+
+    // Runs requests arriving at `gate` and blocks until all are answered.
+    // Requests for different plates run in parallel; as with concurrent
+    // ParkingLot callers, send a plate's next request once the previous one
+    // has been answered.
+    void execute(int gate, ShardRequest* requests, size_t count) {
+        if (count == 0)
+            return;
+        ShardBatch batch;
+        batch.pending.store(count, memory_order_relaxed);
+        for (size_t i = 0; i < count; ++i) {
+            requests[i].stage = ShardRequest::Stage::Lookup;
+            requests[i].directoryShard = plateHash(requests[i].licensePlate) % shards.size();
+            requests[i].gateShard = shardForGate(gate);
+            requests[i].batch = &batch;
+        }
+        for (size_t i = 0; i < count; ++i)
+            send(requests[i].directoryShard, &requests[i]);
+        unique_lock<mutex> lock(batch.mtx);
+        batch.answered.wait(lock, [&] { return batch.finished; });
+    }
+
+    void execute(int gate, vector<ShardRequest>& requests) {
+        execute(gate, requests.data(), requests.size());
+    }
+
+    ParkingResult parkVehicle(int gate, const string& licensePlate, VehicleType type) {
+        vector<ShardRequest> requests(1, ShardRequest(ShardOp::Park, licensePlate, type));
+        execute(gate, requests);
+        return requests[0].result;
+    }
+
+    ParkingResult removeVehicle(int gate, const string& licensePlate) {
+        vector<ShardRequest> requests(1, ShardRequest(ShardOp::Remove, licensePlate));
+        execute(gate, requests);
+        return requests[0].result;
+    }
+
+    ParkingResult findVehicle(int gate, const string& licensePlate) {
+        vector<ShardRequest> requests(1, ShardRequest(ShardOp::Find, licensePlate));
+        execute(gate, requests);
+        return requests[0].result;
+    }
+
+    // Free spots per floor, lot-wide. Reads each shard's counters only.
+    vector<int> getAvailableSpotsPerFloor() const {
+        vector<int> available;
+        for (auto& shard : shards) {
+            vector<int> floors = shard->lot->getAvailableSpotsPerFloor();
+            available.insert(available.end(), floors.begin(), floors.end());
+        }
+        return available;
+    }
+
+    // Parks placed outside the shard of the gate they arrived at.
+    long long spilledParks() const {
+        long long spilled = 0;
+        for (auto& shard : shards)
+            spilled += shard->spilledIn.load(memory_order_relaxed);
+        return spilled;
+    }
+
+    // Checks every shard's lot, and that each directory entry matches the
+    // vehicle on its holding shard and nothing else is parked. Only valid
+    // while no request is in flight.
+    bool verifyConsistency() {
+        long long recordedSpots = 0;
+        long long occupiedSpots = 0;
+        for (size_t s = 0; s < shards.size(); ++s) {
+            Shard& shard = *shards[s];
+            if (!shard.lot->verifyConsistency())
+                return false;
+            for (int free : shard.lot->getAvailableSpotsPerFloor())
+                occupiedSpots -= free;
+            occupiedSpots += (long long)shard.lot->floors.size() * shard.lot->floors[0]->spotCount();
+            for (auto& entry : shard.directory) {
+                const PlateRecord& record = entry.second;
+                if (record.holder < 0 || plateHash(entry.first) % shards.size() != s)
+                    return false;
+                Shard& holder = *shards[record.holder];
+                ParkingResult found = holder.lot->findVehicle(entry.first);
+                if (found.status != ParkingStatus::Found
+                    || found.floorNumber + holder.firstFloor != record.placement.floorNumber
+                    || found.spots.front() != record.placement.spots.front())
+                    return false;
+                recordedSpots += found.spots.size();
+            }
+        }
+        return recordedSpots == occupiedSpots;
+    }
+};
+
+//------------------------------------------------------
+// Stress test: hammers one ParkingLot from 1..32 threads with overlapping
+// license plates, checks that no spot or plate is ever assigned twice, and
+// reports throughput for each thread count and claim mode.
+
+// Heavy contention on one small floor whose spots span three bitmap words, so
+// Truck runs often straddle a word boundary. Each thread parks and removes
+// its own plates and keeps a shared owner table: a spot is marked when a park
+// of it returns and unmarked just before the remove is issued. Any spot the
+// lot hands out while still marked, any result that contradicts the thread's
+// own history, or any disagreement with the lot at the end is a violation.
+static bool checkExclusiveClaims(ClaimMode claimMode, AllocationPolicy policy) {
+    const int spotsPerFloor = 150;
+    const int threads = 8;
+    const int platesPerThread = 16;
+    const int opsPerThread = 40000;
+    ParkingLot lot(1, spotsPerFloor, policy, claimMode);
+    vector<atomic<int>> owners(spotsPerFloor);
+    for (auto& owner : owners)
+        owner.store(0);
+    atomic<long long> violations(0);
+    atomic<int> ready(0);
+
+    auto worker = [&](int id) {
+        vector<ParkingResult> held(platesPerThread, ParkingResult(ParkingStatus::NotFound));
+        vector<string> plates;
+        for (int k = 0; k < platesPerThread; ++k)
+            plates.push_back("X" + to_string(id) + "-" + to_string(k));
+        uint32_t seed = 2654435761u * (id + 1);
+        ready++;
+        while (ready.load() < threads)
+            this_thread::yield();
+        for (int i = 0; i < opsPerThread; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            int k = (seed >> 8) % platesPerThread;
+            int tag = id * platesPerThread + k + 1;
+            ParkingResult& mine = held[k];
+            if (mine.status != ParkingStatus::Parked) {
+                VehicleType type = static_cast<VehicleType>((seed >> 16) % 3);
+                ParkingResult result = lot.parkVehicle(plates[k], type);
+                if (result.status == ParkingStatus::NoSpace)
+                    continue;
+                bool ok = result.status == ParkingStatus::Parked
+                          && result.spots.size() == Vehicle(plates[k], type).getRequiredSpots();
+                for (int j = 0; ok && j < result.spots.size(); ++j) {
+                    int expected = 0;
+                    ok = result.spots[j] == result.spots.front() + j
+                         && owners[result.spots[j]].compare_exchange_strong(expected, tag);
+                }
+                if (!ok)
+                    violations++;
+                mine = result;
+            } else if ((seed >> 16) % 4 == 0) {
+                ParkingResult found = lot.findVehicle(plates[k]);
+                if (found.status != ParkingStatus::Found || found.floorNumber != mine.floorNumber
+                    || found.spots.front() != mine.spots.front())
+                    violations++;
+            } else {
+                for (int spot : mine.spots) {
+                    int expected = tag;
+                    if (!owners[spot].compare_exchange_strong(expected, 0))
+                        violations++;
+                }
+                ParkingResult removed = lot.removeVehicle(plates[k]);
+                if (removed.status != ParkingStatus::Removed || removed.spots.front() != mine.spots.front())
+                    violations++;
+                mine = ParkingResult(ParkingStatus::NotFound);
+            }
+        }
+    };
+    vector<thread> pool;
+    for (int t = 0; t < threads; ++t)
+        pool.emplace_back(worker, t);
+    for (auto& th : pool)
+        th.join();
+
+    for (int spot = 0; spot < spotsPerFloor; ++spot)
+        if (lot.floors[0]->isOccupied(spot) != (owners[spot].load() != 0))
+            violations++;
+    bool passed = violations == 0 && lot.verifyConsistency();
+    cout << "Exclusive claims (" << (claimMode == ClaimMode::FloorLock ? "floor lock" : "atomic bitmap")
+         << ", " << (policy == AllocationPolicy::FirstFit ? "first" : "next") << " fit): "
+         << (passed ? "ok" : "FAILED, " + to_string(violations.load()) + " violation(s)") << endl;
+    return passed;
+}
+
+// Eight gates on a four-shard lot small enough that parks often spill. Each
+// gate sends batches of requests for its own plates and checks each answer
+// against its own history; a few plates are shared by all gates to test that
+// a plate is never parked twice. Ends with ShardedLot::verifyConsistency.
+static bool checkShardedLot() {
+    const int gates = 8;
+    const int platesPerGate = 48;
+    const int batchesPerGate = 400;
+    ShardedLot lot(4, 1, 64);
+    atomic<long long> violations(0);
+
+    auto gate = [&](int id) {
+        vector<ParkingResult> held(platesPerGate, ParkingResult(ParkingStatus::NotFound));
+        vector<string> plates;
+        for (int k = 0; k < platesPerGate; ++k)
+            plates.push_back("S" + to_string(id) + "-" + to_string(k));
+        uint32_t seed = 2654435761u * (id + 1);
+        vector<ShardRequest> requests;
+        vector<int> asked;
+        for (int b = 0; b < batchesPerGate; ++b) {
+            requests.clear();
+            asked.clear();
+            // Distinct plates within a batch: k, k + step, ...
+            seed = seed * 1664525u + 1013904223u;
+            int first = (seed >> 8) % platesPerGate;
+            for (int k = first; k < platesPerGate; k += 5) {
+                seed = seed * 1664525u + 1013904223u;
+                VehicleType type = static_cast<VehicleType>((seed >> 16) % 3);
+                if (held[k].status != ParkingStatus::Parked)
+                    requests.emplace_back(ShardOp::Park, plates[k], type);
+                else
+                    requests.emplace_back((seed >> 20) % 4 == 0 ? ShardOp::Find : ShardOp::Remove, plates[k]);
+                asked.push_back(k);
+            }
+            requests.emplace_back(ShardOp::Park, "SHARED-" + to_string(seed % 4), VehicleType::Car);
+            requests.emplace_back(ShardOp::Remove, "SHARED-" + to_string((seed >> 4) % 4));
+            lot.execute(id, requests);
+
+            for (size_t i = 0; i < asked.size(); ++i) {
+                ParkingResult& mine = held[asked[i]];
+                const ParkingResult& result = requests[i].result;
+                switch (requests[i].op) {
+                case ShardOp::Park:
+                    if (result.status == ParkingStatus::Parked)
+                        mine = result;
+                    else if (result.status != ParkingStatus::NoSpace)
+                        violations++;
+                    break;
+                case ShardOp::Find:
+                    if (result.status != ParkingStatus::Found || result.floorNumber != mine.floorNumber
+                        || result.spots.front() != mine.spots.front())
+                        violations++;
+                    break;
+                case ShardOp::Remove:
+                    if (result.status != ParkingStatus::Removed || result.floorNumber != mine.floorNumber
+                        || result.spots.front() != mine.spots.front())
+                        violations++;
+                    mine = ParkingResult(ParkingStatus::NotFound);
+                    break;
+                }
+            }
+        }
+    };
+    vector<thread> pool;
+    for (int g = 0; g < gates; ++g)
+        pool.emplace_back(gate, g);
+    for (auto& th : pool)
+        th.join();
+
+    bool passed = violations == 0 && lot.spilledParks() > 0 && lot.verifyConsistency();
+    cout << "Sharded lot (" << lot.spilledParks() << " spilled parks): "
+         << (passed ? "ok" : "FAILED, " + to_string(violations.load()) + " violation(s)") << endl;
+    return passed;
+}
+
+static bool checkServer();   // with the server, below
+
+// Runs the throughput sweep under both claim modes, then checkExclusiveClaims,
+// checkShardedLot and checkServer.
+static int runStressTest() {
+    const int numFloors = 8;
+    const int spotsPerFloor = 512;
+    const int opsPerThread = 20000;
+    const int plateSpace = 4096;   // shared across threads to force collisions
+    bool allConsistent = true;
+
+    vector<tuple<ClaimMode, int, double>> results;   // claim mode, threads, ops/sec
+    for (ClaimMode claimMode : {ClaimMode::FloorLock, ClaimMode::AtomicBitmap}) {
+        for (int threads = 1; threads <= 32; threads *= 2) {
+            ParkingLot lot(numFloors, spotsPerFloor, AllocationPolicy::FirstFit, claimMode);
+            atomic<int> ready(0);
+            auto worker = [&](int id) {
+                uint32_t seed = 2654435761u * (id + 1);
+                ready++;
+                while (ready.load() < threads)
+                    this_thread::yield();
+                for (int i = 0; i < opsPerThread; ++i) {
+                    seed = seed * 1664525u + 1013904223u;
+                    string plate = "P" + to_string((seed >> 8) % plateSpace);
+                    VehicleType type = static_cast<VehicleType>((seed >> 12) % 3);
+                    switch ((seed >> 4) % 16) {
+                    case 0: {
+                        // Occasional bulk arrival of a run of consecutive plates.
+                        vector<Vehicle> vehicles;
+                        for (int k = 0; k < 8; ++k)
+                            vehicles.emplace_back("P" + to_string(((seed >> 8) + k) % plateSpace), type);
+                        lot.parkVehicles(vehicles);
+                        break;
+                    }
+                    case 1: {
+                        vector<string> plates;
+                        for (int k = 0; k < 8; ++k)
+                            plates.push_back("P" + to_string(((seed >> 8) + k) % plateSpace));
+                        lot.removeVehicles(plates);
+                        break;
+                    }
+                    default:
+                        if ((seed >> 4) % 2 == 0)
+                            lot.parkVehicle(plate, type);
+                        else
+                            lot.removeVehicle(plate);
+                    }
+                }
+            };
+
+            auto start = chrono::steady_clock::now();
+            vector<thread> pool;
+            for (int t = 0; t < threads; ++t)
+                pool.emplace_back(worker, t);
+            for (auto& th : pool)
+                th.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            if (!lot.verifyConsistency())
+                allConsistent = false;
+            results.emplace_back(claimMode, threads, threads * (double)opsPerThread / seconds);
+        }
+    }
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto [claimMode, threads, opsPerSec] = results[i];
+        if (i == 0 || claimMode != get<0>(results[i - 1]))
+            cout << (claimMode == ClaimMode::FloorLock ? "Floor lock claims:" : "Atomic bitmap claims:") << endl;
+        cout << threads << " thread(s): " << (long long)opsPerSec << " ops/sec" << endl;
+    }
+    for (ClaimMode claimMode : {ClaimMode::FloorLock, ClaimMode::AtomicBitmap})
+        for (AllocationPolicy policy : {AllocationPolicy::FirstFit, AllocationPolicy::NextFit})
+            if (!checkExclusiveClaims(claimMode, policy))
+                allConsistent = false;
+    if (!checkShardedLot())
+        allConsistent = false;
+    if (!checkServer())
+        allConsistent = false;
+    cout << (allConsistent ? "Consistency check passed." : "Consistency check FAILED.") << endl;
+    return allConsistent ? 0 : 1;
+}
+
+//------------------------------------------------------
+// Benchmark helpers.
+
+// Collects per-operation latencies (in ns) and summarizes them.
+class LatencySamples {
+    vector<uint32_t> samples;
+
+public:
+    void reserve(size_t n) { samples.reserve(n); }
+    void add(uint64_t ns) { samples.push_back((uint32_t)min<uint64_t>(ns, UINT32_MAX)); }
+    size_t count() const { return samples.size(); }
+    void append(const LatencySamples& other) {
+        samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+    }
+
+    // Latency at quantile q in [0, 1]. Reorders the samples.
+    uint64_t percentile(double q) {
+        if (samples.empty())
+            return 0;
+        size_t k = min(samples.size() - 1, (size_t)(q * samples.size()));
+        nth_element(samples.begin(), samples.begin() + k, samples.end());
+        return samples[k];
+    }
+
+    double meanNs() const {
+        if (samples.empty())
+            return 0;
+        double total = 0;
+        for (uint32_t s : samples)
+            total += s;
+        return total / samples.size();
+    }
+};
+
+// Times one call in nanoseconds.
+template <typename Fn>
+static uint64_t timeNs(Fn fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Deterministic vehicle type for the i-th arrival of a traffic mix.
+enum class VehicleMix { CarsOnly, Mixed };
+
+static VehicleType mixVehicleType(VehicleMix mix, uint32_t r) {
+    if (mix == VehicleMix::CarsOnly)
+        return VehicleType::Car;
+    // Mixed traffic: 30% bikes, 50% cars, 20% trucks.
+    uint32_t p = r % 10;
+    return p < 3 ? VehicleType::Bike : (p < 8 ? VehicleType::Car : VehicleType::Truck);
+}
+
+static uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+//------------------------------------------------------
+// Core benchmark: times every public ParkingLot operation across lot sizes,
+// occupancy levels and vehicle mixes. Each sample is one call, measured with
+// steady_clock (whose own overhead, ~20ns, is included in the figures).
+static int runCoreBenchmark() {
+    struct LotShape { int floors; int spotsPerFloor; };
+    const LotShape shapes[] = { {1, 10}, {4, 250}, {10, 10000}, {20, 50000} };
+    const int occupancies[] = { 0, 50, 90, 99 };
+    const VehicleMix mixes[] = { VehicleMix::CarsOnly, VehicleMix::Mixed };
+    const int iterations = 20000;
+
+    cout << left << setw(9) << "spots" << setw(6) << "occ%" << setw(7) << "mix"
+         << setw(17) << "operation" << right << setw(14) << "ops/sec"
+         << setw(10) << "p50 ns" << setw(10) << "p99 ns" << endl;
+
+    for (const LotShape& shape : shapes) {
+        for (int occupancy : occupancies) {
+            for (VehicleMix mix : mixes) {
+                ParkingLot lot(shape.floors, shape.spotsPerFloor);
+                long long totalSpots = (long long)shape.floors * shape.spotsPerFloor;
+                uint32_t rng = 12345;
+
+                // Prefill up to the target occupancy.
+                long long target = totalSpots * occupancy / 100;
+                long long occupied = 0;
+                for (int n = 0; occupied < target; ++n) {
+                    VehicleType type = mixVehicleType(mix, nextRandom(rng));
+                    ParkingResult r = lot.parkVehicle("F" + to_string(n), type);
+                    if (r.status != ParkingStatus::Parked)
+                        break;
+                    occupied += r.spots.size();
+                }
+
+                // Each iteration parks a fresh vehicle, looks it up, polls the
+                // occupancy queries and removes it, keeping occupancy steady.
+                LatencySamples park, find, remove, full, perFloor;
+                for (LatencySamples* samples : { &park, &find, &remove, &full, &perFloor })
+                    samples->reserve(iterations);
+                vector<string> plates;
+                for (int i = 0; i < iterations; ++i)
+                    plates.push_back("B" + to_string(i));
+
+                for (int i = 0; i < iterations; ++i) {
+                    const string& plate = plates[i];
+                    VehicleType type = mixVehicleType(mix, nextRandom(rng));
+                    park.add(timeNs([&] { lot.parkVehicle(plate, type); }));
+                    find.add(timeNs([&] { lot.findVehicle(plate); }));
+                    full.add(timeNs([&] { lot.isFull(); }));
+                    perFloor.add(timeNs([&] { lot.getAvailableSpotsPerFloor(); }));
+                    remove.add(timeNs([&] { lot.removeVehicle(plate); }));
+                }
+
+                const char* mixName = (mix == VehicleMix::CarsOnly) ? "cars" : "mixed";
+                pair<const char*, LatencySamples*> rows[] = {
+                    {"parkVehicle", &park}, {"findVehicle", &find}, {"removeVehicle", &remove},
+                    {"isFull", &full}, {"availablePerFloor", &perFloor}
+                };
+                for (auto& row : rows) {
+                    double mean = row.second->meanNs();
+                    cout << left << setw(9) << totalSpots << setw(6) << occupancy << setw(7) << mixName
+                         << setw(17) << row.first << right << setw(14)
+                         << (long long)(mean > 0 ? 1e9 / mean : 0)
+                         << setw(10) << row.second->percentile(0.50)
+                         << setw(10) << row.second->percentile(0.99) << endl;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------
+// Policy benchmark: churns a nearly full lot (each step one random departure
+// and one mixed arrival) under each allocation policy and compares park latency with how
+// fragmented the free space ends up. "Truck rejects" counts Trucks turned
+// away while the lot still had at least two free spots.
+static int runPolicyBenchmark() {
+    const int numFloors = 4;
+    const int spotsPerFloor = 5000;
+    const int churnOps = 200000;
+    const pair<AllocationPolicy, const char*> policies[] = {
+        {AllocationPolicy::FirstFit, "first-fit"},
+        {AllocationPolicy::NextFit, "next-fit"},
+        {AllocationPolicy::BestFit, "best-fit"}
+    };
+
+    cout << left << setw(11) << "policy" << right << setw(10) << "p50 ns" << setw(10) << "p99 ns"
+         << setw(14) << "truck rejects" << setw(12) << "free spots" << setw(11) << "free runs"
+         << setw(13) << "single holes" << setw(13) << "longest run" << endl;
+
+    for (auto& entry : policies) {
+        ParkingLot lot(numFloors, spotsPerFloor, entry.first);
+        uint32_t rng = 2024;
+        vector<string> parked;
+        long long nextPlate = 0;
+        auto arrive = [&](LatencySamples* samples, long long* truckRejects) -> bool {
+            string plate = "C" + to_string(nextPlate++);
+            VehicleType type = mixVehicleType(VehicleMix::Mixed, nextRandom(rng));
+            ParkingStatus status;
+            uint64_t ns = timeNs([&] { status = lot.parkVehicle(plate, type).status; });
+            if (samples != nullptr)
+                samples->add(ns);
+            if (status == ParkingStatus::Parked)
+                parked.push_back(plate);
+            else if (type == VehicleType::Truck && truckRejects != nullptr)
+                *truckRejects += (lot.freeSpotCount() >= 2);
+            return status == ParkingStatus::Parked;
+        };
+
+        // Fill the lot until arrivals keep bouncing, then churn.
+        for (int misses = 0; misses < 100;)
+            misses = arrive(nullptr, nullptr) ? 0 : misses + 1;
+        LatencySamples parkLatency;
+        parkLatency.reserve(churnOps);
+        long long truckRejects = 0;
+        for (int i = 0; i < churnOps; ++i) {
+            if (!parked.empty()) {
+                size_t victim = nextRandom(rng) % parked.size();
+                lot.removeVehicle(parked[victim]);
+                parked[victim] = parked.back();
+                parked.pop_back();
+            }
+            arrive(&parkLatency, &truckRejects);
+        }
+
+        // Fragmentation of the remaining free space.
+        long long freeSpots = 0, freeRuns = 0, singleHoles = 0, longestRun = 0;
+        for (auto* floor : lot.floors) {
+            for (int i = 0; i < floor->spotCount();) {
+                if (floor->isOccupied(i)) {
+                    ++i;
+                    continue;
+                }
+                int j = i;
+                while (j < floor->spotCount() && !floor->isOccupied(j))
+                    ++j;
+                freeSpots += j - i;
+                freeRuns++;
+                singleHoles += (j - i == 1);
+                longestRun = max<long long>(longestRun, j - i);
+                i = j;
+            }
+        }
+
+        cout << left << setw(11) << entry.second << right
+             << setw(10) << parkLatency.percentile(0.50) << setw(10) << parkLatency.percentile(0.99)
+             << setw(14) << truckRejects << setw(12) << freeSpots << setw(11) << freeRuns
+             << setw(13) << singleHoles << setw(13) << longestRun << endl;
+    }
+    return 0;
+}
+
+//------------------------------------------------------
+// Allocation benchmark: cost of the heap Vehicle the lot used to allocate and
+// free per arrival, next to the lot's whole park/remove cycle, which keeps
+// no Vehicle object. The cycle is timed with one plate and with plates
+// rotating through 4096, so index and interner lookups miss the cache too.
+static int runAllocBenchmark() {
+    const int cycles = 2000000;
+    const string plate = "KA-01-1234";
+    auto nsPerCycle = [&](chrono::steady_clock::time_point start) {
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / cycles;
+    };
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < cycles; ++i) {
+        Vehicle* vehicle = new Vehicle(plate, VehicleType::Car);
+        asm volatile("" : : "r"(vehicle) : "memory");   // keep the allocation
+        delete vehicle;
+    }
+    double heapNs = nsPerCycle(start);
+
+    ParkingLot lot(1, 64);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < cycles; ++i) {
+        lot.parkVehicle(plate, VehicleType::Car);
+        lot.removeVehicle(plate);
+    }
+    double cycleNs = nsPerCycle(start);
+
+    vector<string> plates;
+    for (int i = 0; i < 4096; ++i)
+        plates.push_back("KA-" + to_string(i));
+    ParkingLot rotating(4, 1024);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < cycles; ++i) {
+        const string& p = plates[i % plates.size()];
+        rotating.parkVehicle(p, VehicleType::Car);
+        rotating.removeVehicle(p);
+    }
+    double rotatingNs = nsPerCycle(start);
+
+    cout << "new/delete Vehicle:                  " << heapNs << " ns/cycle" << endl;
+    cout << "ParkingLot park+remove, one plate:   " << cycleNs << " ns/cycle" << endl;
+    cout << "ParkingLot park+remove, 4096 plates: " << rotatingNs << " ns/cycle" << endl;
+    return 0;
+}
+
+//------------------------------------------------------
+// Write-ahead log benchmark: park/remove throughput and latency with no log
+// and under each fsync policy, from 1 to 16 threads. Each thread parks and
+// removes its own plates for one second. "ops/fsync" shows how many
+// operations group commit folded into each fsync. The log is written to
+// parkinglot-bench.wal in the working directory (so on that file system)
+// and deleted afterwards.
+static int runWalBenchmark() {
+    const char* path = "parkinglot-bench.wal";
+    const int threadCounts[] = { 1, 4, 16 };
+    struct LogSetup { const char* name; bool enabled; FsyncPolicy fsyncPolicy; int intervalMs; };
+    const LogSetup setups[] = {
+        {"no log", false, FsyncPolicy::Never, 0},
+        {"never", true, FsyncPolicy::Never, 10},
+        {"interval 10ms", true, FsyncPolicy::Interval, 10},
+        {"interval 1ms", true, FsyncPolicy::Interval, 1},
+        {"always", true, FsyncPolicy::Always, 0},
+    };
+
+    cout << left << setw(15) << "fsync" << right << setw(8) << "threads" << setw(14) << "ops/sec"
+         << setw(12) << "p50 ns" << setw(12) << "p99 ns" << setw(12) << "ops/fsync" << endl;
+    for (const LogSetup& setup : setups) {
+        for (int threads : threadCounts) {
+            remove(path);
+            ParkingLot lot(4, 4096);
+            unique_ptr<WriteAheadLog> log;
+            if (setup.enabled) {
+                log.reset(new WriteAheadLog(setup.fsyncPolicy, setup.intervalMs));
+                if (!log->open(path, 0)) {
+                    cerr << "Cannot open " << path << ": " << strerror(errno) << endl;
+                    return 1;
+                }
+                lot.setWriteAheadLog(log.get());
+            }
+
+            vector<LatencySamples> samples(threads);
+            atomic<int> ready(0);
+            auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+            auto worker = [&](int id) {
+                vector<string> plates;
+                for (int i = 0; i < 256; ++i)
+                    plates.push_back("W" + to_string(id) + "-" + to_string(i));
+                ready++;
+                while (ready.load() < threads)
+                    this_thread::yield();
+                for (size_t i = 0; chrono::steady_clock::now() < deadline; ++i) {
+                    const string& plate = plates[i % plates.size()];
+                    samples[id].add(timeNs([&] { lot.parkVehicle(plate, VehicleType::Car); }));
+                    samples[id].add(timeNs([&] { lot.removeVehicle(plate); }));
+                }
+            };
+            auto start = chrono::steady_clock::now();
+            vector<thread> pool;
+            for (int t = 0; t < threads; ++t)
+                pool.emplace_back(worker, t);
+            for (auto& th : pool)
+                th.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            LatencySamples all;
+            for (auto& s : samples)
+                all.append(s);
+            uint64_t syncs = 0;
+            if (log) {
+                lot.setWriteAheadLog(nullptr);
+                syncs = log->syncCount();
+                log.reset();
+            }
+            cout << left << setw(15) << setup.name << right << setw(8) << threads
+                 << setw(14) << (long long)(all.count() / seconds)
+                 << setw(12) << all.percentile(0.50) << setw(12) << all.percentile(0.99);
+            if (syncs > 0)
+                cout << setw(12) << (long long)(all.count() / syncs);
+            else
+                cout << setw(12) << "-";
+            cout << endl;
+        }
+    }
+    remove(path);
+    return 0;
+}
+
+//------------------------------------------------------
+// Claim benchmark: park/remove throughput under each ClaimMode as gates are
+// added, on a lot with few floors so gates collide on the same floor. Each
+// thread churns its own plates for one second with the lot about half full.
+static int runClaimBenchmark() {
+    const int threadCounts[] = { 1, 2, 4, 8, 16 };
+    const VehicleMix mixes[] = { VehicleMix::CarsOnly, VehicleMix::Mixed };
+    cout << left << setw(15) << "claims" << setw(7) << "mix" << right << setw(8) << "threads"
+         << setw(14) << "ops/sec" << setw(12) << "p50 ns" << setw(12) << "p99 ns" << endl;
+    for (VehicleMix mix : mixes) {
+        for (ClaimMode claimMode : {ClaimMode::FloorLock, ClaimMode::AtomicBitmap}) {
+            for (int threads : threadCounts) {
+                const int numFloors = 2, spotsPerFloor = 2048;
+                ParkingLot lot(numFloors, spotsPerFloor, AllocationPolicy::FirstFit, claimMode);
+                int platesPerThread = numFloors * spotsPerFloor / 3 / threads;
+                vector<LatencySamples> samples(threads);
+                atomic<int> ready(0);
+                auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+                auto worker = [&](int id) {
+                    vector<string> plates;
+                    vector<VehicleType> types;
+                    uint32_t seed = 2654435761u * (id + 1);
+                    for (int i = 0; i < platesPerThread; ++i) {
+                        plates.push_back("C" + to_string(id) + "-" + to_string(i));
+                        types.push_back(mixVehicleType(mix, nextRandom(seed)));
+                        lot.parkVehicle(plates.back(), types.back());
+                    }
+                    ready++;
+                    while (ready.load() < threads)
+                        this_thread::yield();
+                    for (size_t i = 0; chrono::steady_clock::now() < deadline; ++i) {
+                        size_t k = nextRandom(seed) % plates.size();
+                        samples[id].add(timeNs([&] { lot.removeVehicle(plates[k]); }));
+                        samples[id].add(timeNs([&] { lot.parkVehicle(plates[k], types[k]); }));
+                    }
+                };
+                auto start = chrono::steady_clock::now();
+                vector<thread> pool;
+                for (int t = 0; t < threads; ++t)
+                    pool.emplace_back(worker, t);
+                for (auto& th : pool)
+                    th.join();
+                double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+                LatencySamples all;
+                for (auto& s : samples)
+                    all.append(s);
+                cout << left << setw(15) << (claimMode == ClaimMode::FloorLock ? "floor lock" : "atomic bitmap")
+                     << setw(7) << (mix == VehicleMix::CarsOnly ? "cars" : "mixed") << right << setw(8) << threads
+                     << setw(14) << (long long)(all.count() / seconds)
+                     << setw(12) << all.percentile(0.50) << setw(12) << all.percentile(0.99) << endl;
+            }
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------
+// Read benchmark: findVehicle and getAvailableSpotsPerFloor from 1..16
+// reader threads (kiosks, apps, signage) while one writer keeps parking and
+// removing. Reports read throughput and the writer's throughput next to it.
+static int runReadBenchmark() {
+    const int threadCounts[] = { 1, 2, 4, 8, 16 };
+    const int numFloors = 10, spotsPerFloor = 1000;
+    const int plateCount = numFloors * spotsPerFloor;
+    cout << right << setw(8) << "readers" << setw(14) << "reads/sec" << setw(12) << "p50 ns" << setw(12) << "p99 ns"
+         << setw(14) << "writes/sec" << endl;
+    for (int readers : threadCounts) {
+        ParkingLot lot(numFloors, spotsPerFloor);
+        vector<string> plates;
+        for (int i = 0; i < plateCount; ++i) {
+            plates.push_back("R" + to_string(i));
+            if (i % 2 == 0)
+                lot.parkVehicle(plates.back(), VehicleType::Car);
+        }
+        vector<LatencySamples> samples(readers);
+        atomic<long long> writes(0);
+        atomic<int> ready(0);
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+        auto reader = [&](int id) {
+            uint32_t seed = 2654435761u * (id + 1);
+            ready++;
+            while (ready.load() < readers + 1)
+                this_thread::yield();
+            for (size_t i = 0; chrono::steady_clock::now() < deadline; ++i) {
+                if (i % 16 == 15) {
+                    samples[id].add(timeNs([&] { lot.getAvailableSpotsPerFloor(); }));
+                } else {
+                    const string& plate = plates[nextRandom(seed) % plateCount];
+                    samples[id].add(timeNs([&] { lot.findVehicle(plate); }));
+                }
+            }
+        };
+        auto writer = [&] {
+            uint32_t seed = 12345;
+            ready++;
+            while (ready.load() < readers + 1)
+                this_thread::yield();
+            long long done = 0;
+            while (chrono::steady_clock::now() < deadline) {
+                const string& plate = plates[nextRandom(seed) % plateCount];
+                if (lot.removeVehicle(plate).status != ParkingStatus::Removed)
+                    lot.parkVehicle(plate, VehicleType::Car);
+                ++done;
+            }
+            writes = done;
+        };
+        auto start = chrono::steady_clock::now();
+        vector<thread> pool;
+        for (int t = 0; t < readers; ++t)
+            pool.emplace_back(reader, t);
+        pool.emplace_back(writer);
+        for (auto& th : pool)
+            th.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        LatencySamples all;
+        for (auto& s : samples)
+            all.append(s);
+        cout << right << setw(8) << readers << setw(14) << (long long)(all.count() / seconds)
+             << setw(12) << all.percentile(0.50) << setw(12) << all.percentile(0.99)
+             << setw(14) << (long long)(writes.load() / seconds) << endl;
+    }
+    return 0;
+}
+
+//------------------------------------------------------
+// Shard benchmark: four gates, each parking and removing its own cars in
+// windows of 64, against one shared lot (gate threads call ParkingLot
+// directly) and against a ShardedLot with one two-floor shard per gate, whose
+// gates send each window as one batch or one request at a time. "uniform":
+// every gate keeps 75% of a shard parked; "skewed": gate 0 keeps 150% and the
+// others 50%, so gate 0's parks spill onto the other shards.
+static int runShardBenchmark() {
+    const int gates = 4, floorsPerShard = 2, spotsPerFloor = 256;
+    const int window = 64, rounds = 400;
+    cout << left << setw(10) << "workload" << setw(16) << "design" << right << setw(14) << "ops/sec"
+         << setw(10) << "spilled" << endl;
+    for (bool skewed : {false, true}) {
+        vector<int> residentWindows(gates, 6);
+        if (skewed) {
+            residentWindows.assign(gates, 4);
+            residentWindows[0] = 12;
+        }
+        // Each gate parks one window per round and, once it holds its
+        // resident windows, removes the oldest one.
+        auto runGates = [&](auto run) {
+            atomic<int> ready(0);
+            atomic<long long> ops(0);
+            auto gate = [&](int g) {
+                vector<ShardRequest> requests;
+                ready++;
+                while (ready.load() < gates)
+                    this_thread::yield();
+                for (int r = 0; r < rounds; ++r) {
+                    requests.clear();
+                    for (int i = 0; i < window; ++i)
+                        requests.emplace_back(ShardOp::Park, "G" + to_string(g) + "-" + to_string(r * window + i));
+                    run(g, requests);
+                    ops += requests.size();
+                    if (r < residentWindows[g])
+                        continue;
+                    int oldest = r - residentWindows[g];
+                    requests.clear();
+                    for (int i = 0; i < window; ++i)
+                        requests.emplace_back(ShardOp::Remove, "G" + to_string(g) + "-" + to_string(oldest * window + i));
+                    run(g, requests);
+                    ops += requests.size();
+                }
+            };
+            auto start = chrono::steady_clock::now();
+            vector<thread> pool;
+            for (int g = 0; g < gates; ++g)
+                pool.emplace_back(gate, g);
+            for (auto& th : pool)
+                th.join();
+            return ops.load() / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        };
+        const char* workload = skewed ? "skewed" : "uniform";
+        long long parks = (long long)gates * rounds * window;
+
+        ParkingLot shared(gates * floorsPerShard, spotsPerFloor);
+        double rate = runGates([&](int, vector<ShardRequest>& requests) {
+            for (auto& request : requests)
+                request.result = request.op == ShardOp::Park
+                                 ? shared.parkVehicle(request.licensePlate, request.type)
+                                 : shared.removeVehicle(request.licensePlate);
+        });
+        cout << left << setw(10) << workload << setw(16) << "shared" << right << setw(14) << (long long)rate
+             << setw(10) << "-" << endl;
+
+        for (bool batched : {true, false}) {
+            ShardedLot sharded(gates, floorsPerShard, spotsPerFloor);
+            rate = runGates([&](int g, vector<ShardRequest>& requests) {
+                if (batched) {
+                    sharded.execute(g, requests.data(), requests.size());
+                } else {
+                    for (auto& request : requests)
+                        sharded.execute(g, &request, 1);
+                }
+            });
+            ostringstream spilled;
+            spilled << fixed << setprecision(1) << 100.0 * sharded.spilledParks() / parks << '%';
+            cout << left << setw(10) << workload << setw(16) << (batched ? "sharded x64" : "sharded x1")
+                 << right << setw(14) << (long long)rate << setw(10) << spilled.str() << endl;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------
+// Lot construction settings shared by every mode of the binary.
+struct LotOptions {
+    int numFloors = -1;       // -1: not given on the command line
+    int spotsPerFloor = -1;
+    AllocationPolicy policy = AllocationPolicy::FirstFit;
+    ClaimMode claimMode = ClaimMode::FloorLock;
+    string snapshotPath;      // empty: no snapshot
+    string walPath;           // empty: no write-ahead log
+    FsyncPolicy fsyncPolicy = FsyncPolicy::Interval;
+    int fsyncIntervalMs = 10;
+};
+
+static bool parseAllocationPolicy(const string& name, AllocationPolicy& policy) {
+    if (name == "first")
+        policy = AllocationPolicy::FirstFit;
+    else if (name == "next")
+        policy = AllocationPolicy::NextFit;
+    else if (name == "best")
+        policy = AllocationPolicy::BestFit;
+    else
+        return false;
+    return true;
+}
+
+static bool parseClaimMode(const string& name, ClaimMode& claimMode) {
+    if (name == "lock")
+        claimMode = ClaimMode::FloorLock;
+    else if (name == "cas")
+        claimMode = ClaimMode::AtomicBitmap;
+    else
+        return false;
+    return true;
+}
+
+static bool parseFsyncPolicy(const string& name, FsyncPolicy& policy) {
+    if (name == "always")
+        policy = FsyncPolicy::Always;
+    else if (name == "interval")
+        policy = FsyncPolicy::Interval;
+    else if (name == "never")
+        policy = FsyncPolicy::Never;
+    else
+        return false;
+    return true;
+}
+
+// Rebuilds `lot` from the snapshot and write-ahead log in `options` (either
+// may be absent): the snapshot is loaded first, then the log records after
+// the snapshot's cut are replayed. The log is then opened so every further
+// change is appended to it. Call before any other traffic reaches the lot
+// and before an event sink is attached. Returns false, with a message on
+// stderr, if either file is unreadable or does not fit this lot.
+static bool recoverLot(ParkingLot& lot, const LotOptions& options, unique_ptr<WriteAheadLog>& log) {
+    uint64_t snapshotPosition = 0;
+    if (!options.snapshotPath.empty() && access(options.snapshotPath.c_str(), F_OK) == 0) {
+        shared_ptr<SnapshotFile> snapshot = make_shared<SnapshotFile>();
+        if (!snapshot->open(options.snapshotPath) || !lot.restoreSnapshot(snapshot)) {
+            cerr << "Cannot restore snapshot " << options.snapshotPath << endl;
+            return false;
+        }
+        snapshotPosition = snapshot->header().logPosition;
+    }
+    lot.setSnapshotPath(options.snapshotPath);
+    if (options.walPath.empty())
+        return true;
+
+    // A log checkpointed past the snapshot has lost records the snapshot does
+    // not hold; refuse it before touching the lot.
+    uint64_t basePosition = 0, validBytes = 0;
+    if (!WriteAheadLog::readBasePosition(options.walPath, basePosition)) {
+        cerr << options.walPath << " is not a write-ahead log" << endl;
+        return false;
+    }
+    if (basePosition > snapshotPosition) {
+        cerr << "Write-ahead log " << options.walPath
+             << " was checkpointed by a newer snapshot than the one loaded" << endl;
+        return false;
+    }
+
+    long long records = 0;
+    auto apply = [&](const WalRecordHeader& record, const string& licensePlate, uint64_t position) {
+        if (position <= snapshotPosition)
+            return true;   // already in the snapshot
+        bool applied = false;
+        if (record.op == (uint8_t)WalOp::Park && record.vehicleType <= (uint8_t)VehicleType::Truck) {
+            Vehicle vehicle(licensePlate, static_cast<VehicleType>(record.vehicleType));
+            applied = lot.restoreParked(vehicle, record.floorNumber, record.firstSpot);
+        } else if (record.op == (uint8_t)WalOp::Remove) {
+            applied = lot.restoreRemoved(licensePlate, record.floorNumber, record.firstSpot);
+        }
+        if (applied)
+            records++;
+        return applied;
+    };
+    if (!WriteAheadLog::readRecords(options.walPath, apply, basePosition, validBytes)) {
+        cerr << "Cannot recover from " << options.walPath << ": record " << records + 1
+             << " is not valid for a lot of this size" << endl;
+        return false;
+    }
+
+    log.reset(new WriteAheadLog(options.fsyncPolicy, options.fsyncIntervalMs));
+    if (!log->open(options.walPath, validBytes)) {
+        cerr << "Cannot open write-ahead log " << options.walPath << ": " << strerror(errno) << endl;
+        return false;
+    }
+    lot.setWriteAheadLog(log.get());
+    if (records > 0)
+        cerr << "Recovered " << records << " change(s) from " << options.walPath << endl;
+    return true;
+}
+
+//------------------------------------------------------
+// Command parsing and execution, shared by the interactive CLI and the tools
+// that replay or generate CLI commands.
+enum class CommandType {
+    ParkVehicle,
+    RemoveVehicle,
+    ParkVehicles,
+    RemoveVehicles,
+    AvailableSpots,
+    IsFull,
+    FindVehicle,
+    Snapshot,
+    Stats,
+    Exit,
+    Invalid
+};
+
+struct Command {
+    CommandType type;
+    string_view licensePlate;   // views into the parsed line
+    VehicleType vehicleType;
+    string_view arguments;      // the argument list of a bulk command
+    const char* error;          // response for an Invalid command
+};
+
+// Splits off the next whitespace-separated token of `rest`.
+static string_view nextToken(string_view& rest) {
+    size_t begin = 0;
+    while (begin < rest.size() && isspace((unsigned char)rest[begin]))
+        ++begin;
+    size_t end = begin;
+    while (end < rest.size() && !isspace((unsigned char)rest[end]))
+        ++end;
+    string_view token = rest.substr(begin, end - begin);
+    rest.remove_prefix(end);
+    return token;
+}
+
+static bool parseVehicleType(string_view name, VehicleType& type) {
+    if (name == "Bike")
+        type = VehicleType::Bike;
+    else if (name == "Car")
+        type = VehicleType::Car;
+    else if (name == "Truck")
+        type = VehicleType::Truck;
+    else
+        return false;
+    return true;
+}
+
+// Parses one command line. The returned Command refers into `line`.
+static Command parseCommand(string_view line) {
+    Command command{CommandType::Invalid, string_view(), VehicleType::Car, string_view(),
+                    "Invalid command."};
+    string_view name = nextToken(line);
+
+    if (name == "park_vehicle") {
+        command.licensePlate = nextToken(line);
+        string_view typeName = nextToken(line);
+        if (command.licensePlate.empty() || typeName.empty())
+            command.error = "Invalid input. Usage: park_vehicle <license_plate> <vehicle_type>";
+        else if (!parseVehicleType(typeName, command.vehicleType))
+            command.error = "Unknown vehicle type.";
+        else
+            command.type = CommandType::ParkVehicle;
+    }
+    else if (name == "remove_vehicle" || name == "find_vehicle") {
+        command.licensePlate = nextToken(line);
+        bool remove = (name == "remove_vehicle");
+        if (command.licensePlate.empty())
+            command.error = remove ? "Usage: remove_vehicle <license_plate>"
+                                   : "Usage: find_vehicle <license_plate>";
+        else
+            command.type = remove ? CommandType::RemoveVehicle : CommandType::FindVehicle;
+    }
+    else if (name == "park_vehicles") {
+        command.arguments = line;
+        size_t count = 0;
+        for (string_view token = nextToken(line); !token.empty(); token = nextToken(line), ++count) {
+            VehicleType type;
+            if (count % 2 == 1 && !parseVehicleType(token, type)) {
+                command.error = "Unknown vehicle type.";
+                return command;
+            }
+        }
+        if (count == 0 || count % 2 != 0)
+            command.error = "Usage: park_vehicles <license_plate> <vehicle_type> [<license_plate> <vehicle_type> ...]";
+        else
+            command.type = CommandType::ParkVehicles;
+    }
+    else if (name == "remove_vehicles") {
+        command.arguments = line;
+        if (nextToken(line).empty())
+            command.error = "Usage: remove_vehicles <license_plate> [<license_plate> ...]";
+        else
+            command.type = CommandType::RemoveVehicles;
+    }
+    else if (name == "available_spots") {
+        command.type = CommandType::AvailableSpots;
+    }
+    else if (name == "is_full") {
+        command.type = CommandType::IsFull;
+    }
+    else if (name == "snapshot") {
+        command.arguments = nextToken(line);
+        if (command.arguments.empty())
+            command.error = "Usage: snapshot <path>";
+        else
+            command.type = CommandType::Snapshot;
+    }
+    else if (name == "stats") {
+        command.type = CommandType::Stats;
+    }
+    else if (name == "exit") {
+        command.type = CommandType::Exit;
+    }
+    return command;
+}
+
+// Prints the CLI response for a park/remove/find result. Responses end in
+// '\n' rather than endl: interactive output is flushed by the next prompt and
+// batch output by its buffer, never per line.
+static void printResult(ostream& out, string_view licensePlate, const ParkingResult& result) {
+    switch (result.status) {
+    case ParkingStatus::Parked:
+        out << "Parked " << licensePlate << " on floor " << result.floorNumber << " at spot(s): ";
+        for (int s : result.spots)
+            out << s << " ";
+        out << '\n';
+        break;
+    case ParkingStatus::AlreadyParked:
+        out << "Vehicle " << licensePlate << " is already parked." << '\n';
+        break;
+    case ParkingStatus::NoSpace:
+        out << "Parking Lot Full or no suitable spot available for " << licensePlate << '\n';
+        break;
+    case ParkingStatus::Removed:
+        out << "Vehicle " << licensePlate << " removed from floor " << result.floorNumber << '\n';
+        break;
+    case ParkingStatus::Found:
+        out << "Vehicle " << licensePlate << " is parked on floor " << result.floorNumber << " at spot(s): ";
+        for (int s : result.spots)
+            out << s << " ";
+        out << '\n';
+        break;
+    case ParkingStatus::NotFound:
+        out << "Vehicle " << licensePlate << " not found." << '\n';
+        break;
+    }
+    if (result.logFailed)
+        out << "Warning: the write-ahead log has failed; this change will not survive a restart." << '\n';
+}
+
+// Runs a parsed command against the lot and writes the CLI response to `out`.
+// Exit is the caller's business and produces no output.
+static void executeCommand(ParkingLot& parkingLot, const Command& command, ostream& out) {
+    switch (command.type) {
+    case CommandType::ParkVehicle:
+        printResult(out, command.licensePlate,
+                    parkingLot.parkVehicle(string(command.licensePlate), command.vehicleType));
+        break;
+    case CommandType::RemoveVehicle:
+        printResult(out, command.licensePlate, parkingLot.removeVehicle(string(command.licensePlate)));
+        break;
+    case CommandType::FindVehicle:
+        printResult(out, command.licensePlate, parkingLot.findVehicle(string(command.licensePlate)));
+        break;
+    case CommandType::ParkVehicles: {
+        vector<Vehicle> vehicles;
+        string_view rest = command.arguments;
+        for (string_view plate = nextToken(rest); !plate.empty(); plate = nextToken(rest)) {
+            VehicleType type = VehicleType::Car;
+            parseVehicleType(nextToken(rest), type);
+            vehicles.emplace_back(string(plate), type);
+        }
+        vector<ParkingResult> results = parkingLot.parkVehicles(vehicles);
+        for (size_t i = 0; i < results.size(); ++i)
+            printResult(out, vehicles[i].licensePlate, results[i]);
+        break;
+    }
+    case CommandType::RemoveVehicles: {
+        vector<string> plates;
+        string_view rest = command.arguments;
+        for (string_view plate = nextToken(rest); !plate.empty(); plate = nextToken(rest))
+            plates.emplace_back(plate);
+        vector<ParkingResult> results = parkingLot.removeVehicles(plates);
+        for (size_t i = 0; i < results.size(); ++i)
+            printResult(out, plates[i], results[i]);
+        break;
+    }
+    case CommandType::AvailableSpots: {
+        vector<int> available = parkingLot.getAvailableSpotsPerFloor();
+        for (size_t i = 0; i < available.size(); ++i) {
+            out << "Floor " << i << ": " << available[i] << " spots available." << '\n';
+        }
+        break;
+    }
+    case CommandType::IsFull:
+        if (parkingLot.isFull())
+            out << "Parking lot is full." << '\n';
+        else
+            out << "Parking lot has available spots." << '\n';
+        break;
+    case CommandType::Snapshot:
+        if (parkingLot.saveSnapshot(string(command.arguments)))
+            out << "Snapshot written to " << command.arguments << '\n';
+        else
+            out << "Cannot write snapshot " << command.arguments << '\n';
+        break;
+    case CommandType::Stats:
+        printStats(out);
+        break;
+    case CommandType::Exit:
+        break;
+    case CommandType::Invalid:
+        out << command.error << '\n';
+        break;
+    }
+}
+
+//------------------------------------------------------
+// Trace replay. A trace is a text file of "<seconds> <CLI command>" lines,
+// e.g. "12.5 park_vehicle KA-01-1234 Car", sorted by time. Commands are
+// spread over producer threads by license plate (so each vehicle's commands
+// stay in order) and replayed as fast as possible (speed 0) or paced at
+// `speed` times real time. With pacing, latency is measured from each
+// command's scheduled time, so it includes any queueing behind late commands.
+struct TraceCommand {
+    double time;
+    Command command;
+};
+
+struct ReplayStats {
+    long long parks = 0, rejectedFull = 0, alreadyParked = 0;
+    long long removes = 0, removeNotFound = 0;
+    long long finds = 0, findNotFound = 0;
+    long long queries = 0;
+    LatencySamples latency;
+
+    void merge(const ReplayStats& other) {
+        parks += other.parks;
+        rejectedFull += other.rejectedFull;
+        alreadyParked += other.alreadyParked;
+        removes += other.removes;
+        removeNotFound += other.removeNotFound;
+        finds += other.finds;
+        findNotFound += other.findNotFound;
+        queries += other.queries;
+        latency.append(other.latency);
+    }
+};
+
+// Executes one trace command and tallies its outcome.
+static void replayCommand(ParkingLot& lot, const Command& command, ReplayStats& stats) {
+    switch (command.type) {
+    case CommandType::ParkVehicle: {
+        ParkingStatus status = lot.parkVehicle(string(command.licensePlate), command.vehicleType).status;
+        stats.parks++;
+        stats.rejectedFull += (status == ParkingStatus::NoSpace);
+        stats.alreadyParked += (status == ParkingStatus::AlreadyParked);
+        break;
+    }
+    case CommandType::RemoveVehicle:
+        stats.removes++;
+        stats.removeNotFound += (lot.removeVehicle(string(command.licensePlate)).status != ParkingStatus::Removed);
+        break;
+    case CommandType::ParkVehicles: {
+        // Each vehicle of a bulk command counts like a single park.
+        vector<Vehicle> vehicles;
+        string_view rest = command.arguments;
+        for (string_view plate = nextToken(rest); !plate.empty(); plate = nextToken(rest)) {
+            VehicleType type = VehicleType::Car;
+            parseVehicleType(nextToken(rest), type);
+            vehicles.emplace_back(string(plate), type);
+        }
+        for (const ParkingResult& result : lot.parkVehicles(vehicles)) {
+            stats.parks++;
+            stats.rejectedFull += (result.status == ParkingStatus::NoSpace);
+            stats.alreadyParked += (result.status == ParkingStatus::AlreadyParked);
+        }
+        break;
+    }
+    case CommandType::RemoveVehicles: {
+        vector<string> plates;
+        string_view rest = command.arguments;
+        for (string_view plate = nextToken(rest); !plate.empty(); plate = nextToken(rest))
+            plates.emplace_back(plate);
+        for (const ParkingResult& result : lot.removeVehicles(plates)) {
+            stats.removes++;
+            stats.removeNotFound += (result.status != ParkingStatus::Removed);
+        }
+        break;
+    }
+    case CommandType::FindVehicle:
+        stats.finds++;
+        stats.findNotFound += (lot.findVehicle(string(command.licensePlate)).status != ParkingStatus::Found);
+        break;
+    case CommandType::AvailableSpots:
+        stats.queries++;
+        lot.getAvailableSpotsPerFloor();
+        break;
+    case CommandType::IsFull:
+        stats.queries++;
+        lot.isFull();
+        break;
+    case CommandType::Snapshot:
+    case CommandType::Stats:
+    case CommandType::Exit:
+    case CommandType::Invalid:
+        break;
+    }
+}
+
+static int runReplay(const string& path, const LotOptions& options, int threads, double speed) {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        cerr << "Cannot open trace " << path << endl;
+        return 1;
+    }
+    // Commands keep views into this buffer, so it must outlive the replay.
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    threads = max(1, threads);
+    vector<TraceCommand> trace;
+    unordered_set<string_view> bulkPlates;   // plates named by a bulk command
+    long long malformed = 0;
+    string_view rest(text);
+    while (!rest.empty()) {
+        size_t eol = rest.find('\n');
+        string_view line = rest.substr(0, eol);
+        rest.remove_prefix(eol == string_view::npos ? rest.size() : eol + 1);
+
+        string_view timeToken = nextToken(line);
+        if (timeToken.empty() || timeToken[0] == '#')
+            continue;
+        char* end = nullptr;
+        string timeText(timeToken);
+        double time = strtod(timeText.c_str(), &end);
+        Command command = parseCommand(line);
+        if (*end != '\0' || command.type == CommandType::Invalid) {
+            malformed++;
+            continue;
+        }
+        if (command.type == CommandType::Exit)
+            break;
+        if (command.type == CommandType::ParkVehicles || command.type == CommandType::RemoveVehicles) {
+            string_view arguments = command.arguments;
+            for (string_view plate = nextToken(arguments); !plate.empty(); plate = nextToken(arguments)) {
+                bulkPlates.insert(plate);
+                if (command.type == CommandType::ParkVehicles)
+                    nextToken(arguments);   // its vehicle type
+            }
+        }
+        trace.push_back({time, command});
+    }
+
+    // Each plate's commands run on one thread, so they keep their trace
+    // order. A bulk command names several plates, so bulk commands and every
+    // command for a plate they name go to thread 0. Queries name no plate
+    // and are dealt round-robin.
+    vector<vector<TraceCommand>> perThread(threads);
+    size_t roundRobin = 0;
+    for (const TraceCommand& entry : trace) {
+        const Command& command = entry.command;
+        size_t target;
+        if (command.type == CommandType::ParkVehicles || command.type == CommandType::RemoveVehicles
+            || bulkPlates.count(command.licensePlate) != 0)
+            target = 0;
+        else if (command.licensePlate.empty())
+            target = roundRobin++ % threads;
+        else
+            target = hash<string_view>()(command.licensePlate) % threads;
+        perThread[target].push_back(entry);
+    }
+
+    ParkingLot lot(options.numFloors > 0 ? options.numFloors : 10,
+                   options.spotsPerFloor > 0 ? options.spotsPerFloor : 1000, options.policy,
+                   options.claimMode);
+    vector<ReplayStats> stats(threads);
+    // Give every producer time to start so they all begin at the same instant.
+    auto start = chrono::steady_clock::now() + chrono::milliseconds(50);
+    auto worker = [&](int id) {
+        this_thread::sleep_until(start);
+        for (const TraceCommand& entry : perThread[id]) {
+            auto scheduled = chrono::steady_clock::now();
+            if (speed > 0) {
+                scheduled = start + chrono::duration_cast<chrono::steady_clock::duration>(
+                    chrono::duration<double>(entry.time / speed));
+                this_thread::sleep_until(scheduled);
+            }
+            replayCommand(lot, entry.command, stats[id]);
+            stats[id].latency.add(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - scheduled).count());
+        }
+    };
+    vector<thread> pool;
+    for (int t = 0; t < threads; ++t)
+        pool.emplace_back(worker, t);
+    for (auto& th : pool)
+        th.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ReplayStats total;
+    for (auto& s : stats)
+        total.merge(s);
+    long long commands = total.parks + total.removes + total.finds + total.queries;
+    auto percent = [](long long part, long long whole) {
+        return whole == 0 ? 0.0 : 100.0 * part / whole;
+    };
+    cout << fixed << setprecision(2);
+    cout << "Replayed " << commands << " commands on " << threads << " thread(s) in "
+         << seconds << " s (" << (long long)(commands / seconds) << " ops/sec)";
+    if (malformed > 0)
+        cout << ", skipped " << malformed << " malformed line(s)";
+    cout << endl;
+    cout << "  park_vehicle:   " << total.parks << ", rejected full " << total.rejectedFull
+         << " (" << percent(total.rejectedFull, total.parks) << "%), already parked "
+         << total.alreadyParked << endl;
+    cout << "  remove_vehicle: " << total.removes << ", not found " << total.removeNotFound << endl;
+    cout << "  find_vehicle:   " << total.finds << ", not found " << total.findNotFound << endl;
+    cout << "  queries:        " << total.queries << endl;
+    cout << "  latency ns: p50 " << total.latency.percentile(0.50)
+         << ", p90 " << total.latency.percentile(0.90)
+         << ", p99 " << total.latency.percentile(0.99)
+         << ", max " << total.latency.percentile(1.0) << endl;
+    return 0;
+}
+
+// Writes a synthetic trace: `arrivals` vehicles arriving as a Poisson process
+// at `rate` per second, each staying for an exponentially distributed dwell
+// time with mean `meanDwell` seconds. With probability `findRatio` a vehicle
+// is also looked up halfway through its stay.
+static int generateTrace(const string& path, long long arrivals, double rate, double meanDwell,
+                         double findRatio, uint32_t seed) {
+    ofstream out(path);
+    if (!out) {
+        cerr << "Cannot write trace " << path << endl;
+        return 1;
+    }
+    mt19937 rng(seed);
+    exponential_distribution<double> interArrival(rate);
+    exponential_distribution<double> dwell(1.0 / meanDwell);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+
+    struct Event { double time; long long vehicle; int kind; VehicleType type; };
+    vector<Event> events;
+    double now = 0;
+    for (long long v = 0; v < arrivals; ++v) {
+        now += interArrival(rng);
+        double stay = dwell(rng);
+        VehicleType type = mixVehicleType(VehicleMix::Mixed, rng());
+        events.push_back({now, v, 0, type});
+        if (unit(rng) < findRatio)
+            events.push_back({now + stay / 2, v, 1, type});
+        events.push_back({now + stay, v, 2, type});
+    }
+    stable_sort(events.begin(), events.end(),
+                [](const Event& a, const Event& b) { return a.time < b.time; });
+
+    static const char* const typeNames[] = { "Bike", "Car", "Truck" };
+    out << fixed << setprecision(6);
+    for (const Event& e : events) {
+        out << e.time << ' ';
+        if (e.kind == 0)
+            out << "park_vehicle V" << e.vehicle << ' ' << typeNames[static_cast<int>(e.type)] << '\n';
+        else if (e.kind == 1)
+            out << "find_vehicle V" << e.vehicle << '\n';
+        else
+            out << "remove_vehicle V" << e.vehicle << '\n';
+    }
+    cout << "Wrote " << events.size() << " commands spanning " << fixed << setprecision(1)
+         << (events.empty() ? 0.0 : events.back().time) << " s to " << path << endl;
+    return 0;
+}
+
+//------------------------------------------------------
+// Batch mode: non-interactive command processing for piped or file input.
+// Input is read in large blocks and split into lines in place; responses go
+// through one large output buffer that is written out only when full.
+
+// Reads a file (or stdin) in large blocks and hands out lines as views into
+// the block buffer. A view is valid until the next call to nextLine().
+class LineReader {
+    FILE* file;
+    vector<char> buffer;
+    size_t begin;   // start of unconsumed data
+    size_t end;     // end of valid data
+    bool eof;
+
+public:
+    explicit LineReader(FILE* file, size_t blockSize = 1 << 20)
+        : file(file), buffer(blockSize), begin(0), end(0), eof(false) {}
+
+    bool nextLine(string_view& line) {
+        for (;;) {
+            const char* start = buffer.data() + begin;
+            const char* newline = (const char*)memchr(start, '\n', end - begin);
+            if (newline != nullptr) {
+                line = string_view(start, newline - start);
+                begin += line.size() + 1;
+                return true;
+            }
+            if (eof) {
+                if (begin == end)
+                    return false;
+                line = string_view(start, end - begin);   // last line without '\n'
+                begin = end;
+                return true;
+            }
+            // Move the partial line to the front and refill behind it.
+            size_t partial = end - begin;
+            memmove(buffer.data(), start, partial);
+            begin = 0;
+            end = partial;
+            if (end == buffer.size())
+                buffer.resize(buffer.size() * 2);   // a single line longer than the block
+            size_t n = fread(buffer.data() + end, 1, buffer.size() - end, file);
+            end += n;
+            if (n == 0)
+                eof = true;
+        }
+    }
+};
+
+// streambuf that collects output in a large buffer and writes it to a FILE*
+// only when the buffer fills or the stream is flushed.
+class BufferedOutput : public streambuf {
+    FILE* file;
+    vector<char> buffer;
+
+    bool drain() {
+        size_t n = pptr() - pbase();
+        bool ok = fwrite(pbase(), 1, n, file) == n;
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return ok;
+    }
+
+protected:
+    int overflow(int c) override {
+        if (!drain())
+            return traits_type::eof();
+        if (c != traits_type::eof()) {
+            *pptr() = (char)c;
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        return (drain() && fflush(file) == 0) ? 0 : -1;
+    }
+
+public:
+    explicit BufferedOutput(FILE* file, size_t size = 1 << 20) : file(file), buffer(size) {
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+    ~BufferedOutput() override {
+        sync();
+    }
+};
+
+// Without --floors/--spots, batch input starts with the lot size: two
+// positive integers, on one line or one per line (as typed in interactive
+// mode). Anything else is an error, so a command is never taken for a size.
+static bool readLotSize(LineReader& reader, LotOptions& options) {
+    if (options.numFloors >= 0 && options.spotsPerFloor >= 0)
+        return true;
+    vector<int> sizes;
+    bool valid = true;
+    string_view line;
+    while (valid && sizes.size() < 2 && reader.nextLine(line)) {
+        for (string_view token = nextToken(line); valid && !token.empty(); token = nextToken(line)) {
+            string text(token);
+            char* end = nullptr;
+            long value = strtol(text.c_str(), &end, 10);
+            valid = *end == '\0' && value > 0 && value <= INT32_MAX && sizes.size() < 2;
+            sizes.push_back((int)value);
+        }
+    }
+    if (!valid || sizes.size() < 2) {
+        cerr << "Missing lot size: pass --floors and --spots or start the input with two positive integers"
+             << endl;
+        return false;
+    }
+    if (options.numFloors < 0)
+        options.numFloors = sizes[0];
+    if (options.spotsPerFloor < 0)
+        options.spotsPerFloor = sizes[1];
+    return true;
+}
+
+// Runs commands from `in` without prompts. If the lot size is not given on
+// the command line, the input starts with it (see readLotSize).
+static int runBatch(FILE* in, LotOptions options, EventSink* eventSink) {
+    LineReader reader(in);
+    BufferedOutput buffered(stdout);
+    ostream out(&buffered);
+
+    if (!readLotSize(reader, options))
+        return 1;
+
+    string_view line;
+    ParkingLot parkingLot(options.numFloors, options.spotsPerFloor, options.policy, options.claimMode);
+    unique_ptr<WriteAheadLog> writeAheadLog;
+    if (!recoverLot(parkingLot, options, writeAheadLog))
+        return 1;
+    parkingLot.setEventSink(eventSink);
+    while (reader.nextLine(line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            continue;
+        Command command = parseCommand(line);
+        if (command.type == CommandType::Exit)
+            break;
+        executeCommand(parkingLot, command, out);
+    }
+    out.flush();
+    return 0;
+}
+
+//------------------------------------------------------
+// Work-stealing request engine. Clients (input streams) submit command
+// lines; a pool of workers runs them against one ParkingLot.
+
+// streambuf that appends everything written to it to a string.
+class StringOutput : public streambuf {
+    string& target;
+
+protected:
+    int overflow(int c) override {
+        if (c != traits_type::eof())
+            target.push_back((char)c);
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char* s, streamsize n) override {
+        target.append(s, n);
+        return n;
+    }
+
+public:
+    explicit StringOutput(string& target) : target(target) {}
+};
+
+// WorkStealingDeque: Chase-Lev deque of pointers, used as a queue. The owning
+// worker pushes at the bottom and every thread, the owner included, steals
+// from the top, so items come out in the order they were pushed. Lock-free.
+// The buffer doubles when full, and a replaced buffer is kept until the deque
+// is destroyed, since a thief may still be reading it.
+template <typename T>
+class WorkStealingDeque {
+    struct Buffer {
+        int64_t mask;
+        unique_ptr<atomic<T*>[]> items;
+
+        explicit Buffer(int64_t size) : mask(size - 1), items(new atomic<T*>[size]()) {}
+        T* get(int64_t i) const { return items[i & mask].load(memory_order_relaxed); }
+        void put(int64_t i, T* item) { items[i & mask].store(item, memory_order_relaxed); }
+    };
+
+    alignas(64) atomic<int64_t> top;
+    alignas(64) atomic<int64_t> bottom;
+    atomic<Buffer*> buffer;
+    vector<unique_ptr<Buffer>> buffers;   // current and replaced; owner only
+
+public:
+    WorkStealingDeque() : top(0), bottom(0) {
+        buffers.emplace_back(new Buffer(64));
+        buffer.store(buffers.back().get(), memory_order_relaxed);
+    }
+
+    // Owner only.
+    void push(T* item) {
+        int64_t b = bottom.load(memory_order_relaxed);
+        int64_t t = top.load(memory_order_acquire);
+        Buffer* a = buffer.load(memory_order_relaxed);
+        if (b - t > a->mask) {
+            Buffer* bigger = new Buffer((a->mask + 1) * 2);
+            for (int64_t i = t; i < b; ++i)
+                bigger->put(i, a->get(i));
+            buffers.emplace_back(bigger);
+            buffer.store(bigger, memory_order_release);
+            a = bigger;
+        }
+        a->put(b, item);
+        bottom.store(b + 1, memory_order_release);
+    }
+
+    // Any thread. Returns nullptr if empty or if another thread got the item.
+    T* steal() {
+        int64_t t = top.load(memory_order_seq_cst);
+        int64_t b = bottom.load(memory_order_seq_cst);
+        if (t >= b)
+            return nullptr;
+        T* item = buffer.load(memory_order_acquire)->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+};
+
+// RequestEngine: runs the command lines of many clients on `workers` threads.
+// Each client is a strand: its commands run one at a time in submission
+// order, so its responses come back in that order and its own commands never
+// race each other, while different clients run in parallel. A client with
+// commands waiting is one task. A worker gives it one turn of at most
+// kMaxTurnLines lines; if more are waiting after that, the worker pushes it
+// to the back of its own deque, behind the clients already there. Workers
+// take from the front of their own deque, and idle workers steal from the
+// front of the others', so a busy client neither holds a worker nor keeps
+// the clients queued behind it waiting for a thief. Clients first enter
+// through a shared queue, since only a deque's owner may push to it.
+class RequestEngine {
+public:
+    class Client {
+        friend class RequestEngine;
+        mutex mtx;
+        condition_variable drained;   // `pending` shrank below the backlog limit
+        condition_variable produced;  // `output` grew, or the client went idle
+        string pending;               // submitted lines; those before pendingBegin have run
+        size_t pendingBegin = 0;
+        size_t pendingLines = 0;      // lines after pendingBegin
+        string output;                // responses not yet taken
+        bool scheduled = false;       // queued or running on a worker
+        bool closed = false;          // ran `exit`; later lines are dropped
+        bool finished = false;        // finish() called: no more lines will come
+    };
+
+private:
+    // A client whose submitter gets this far ahead of the workers waits.
+    static const size_t kMaxClientBacklog = 1 << 20;
+    // Lines a client runs per turn before other clients get a worker.
+    static const size_t kMaxTurnLines = 256;
+
+    struct Worker {
+        WorkStealingDeque<Client> deque;
+        thread runner;
+    };
+
+    ParkingLot& lot;
+    vector<unique_ptr<Worker>> workers;
+    vector<unique_ptr<Client>> clients;
+
+    // Guards `injected`, `wakeups` and `stopping`; idle workers sleep on `wake`.
+    mutex mtx;
+    condition_variable wake;
+    deque<Client*> injected;
+    atomic<int> sleepers;
+    uint64_t wakeups;
+    bool stopping;
+
+    // Submitted lines not yet run, for waitIdle.
+    atomic<long long> outstanding;
+    mutex idleMtx;
+    condition_variable idle;
+
+    // Wake a sleeping worker, if any, to steal newly queued work.
+    void notifySleeper() {
+        if (sleepers.load() == 0)
+            return;
+        lock_guard<mutex> lock(mtx);
+        ++wakeups;
+        wake.notify_one();
+    }
+
+    // The shared queue first, so a client that just got work waits for one
+    // turn at most even while this worker's deque stays busy; then its own
+    // deque, then the others' (`mtx` held if `locked`).
+    Client* findWork(size_t self, bool locked) {
+        {
+            unique_lock<mutex> lock(mtx, defer_lock);
+            if (!locked)
+                lock.lock();
+            if (!injected.empty()) {
+                Client* client = injected.front();
+                injected.pop_front();
+                return client;
+            }
+        }
+        if (Client* client = workers[self]->deque.steal())
+            return client;
+        for (size_t k = 1; k < workers.size(); ++k) {
+            if (Client* client = workers[(self + k) % workers.size()]->deque.steal())
+                return client;
+        }
+        return nullptr;
+    }
 
-    ParkingSpot(int floorNumber, int spotNumber)
-        : floorNumber(floorNumber), spotNumber(spotNumber), isOccupied(false) {}
+    // Runs one turn of `client`: up to kMaxTurnLines of its waiting lines.
+    // If more are waiting afterwards, requeues it on this worker's deque.
+    void run(Client* client, size_t self) {
+        string lines, responses;
+        size_t count = 0;
+        bool closed;
+        {
+            lock_guard<mutex> lock(client->mtx);
+            size_t end = client->pendingBegin;
+            while (count < kMaxTurnLines && end < client->pending.size()) {
+                end = client->pending.find('\n', end) + 1;
+                ++count;
+            }
+            lines.assign(client->pending, client->pendingBegin, end - client->pendingBegin);
+            client->pendingLines -= count;
+            if (end == client->pending.size()) {
+                client->pending.clear();
+                client->pendingBegin = 0;
+            } else if (end > client->pending.size() / 2) {
+                client->pending.erase(0, end);   // compact once most of it has run
+                client->pendingBegin = 0;
+            } else {
+                client->pendingBegin = end;
+            }
+            closed = client->closed;
+        }
+        client->drained.notify_all();
 
-    bool assignVehicle(const string& licensePlate) {
-        if (isOccupied)
-            return false;
-        parkedVehicle = licensePlate;
-        isOccupied = true;
-        return true;
+        StringOutput buffer(responses);
+        ostream out(&buffer);
+        for (size_t begin = 0; begin < lines.size() && !closed;) {
+            size_t newline = lines.find('\n', begin);
+            Command command = parseCommand(string_view(lines.data() + begin, newline - begin));
+            begin = newline + 1;
+            if (command.type == CommandType::Exit)
+                closed = true;
+            else
+                executeCommand(lot, command, out);
+        }
+
+        bool requeue;
+        {
+            lock_guard<mutex> lock(client->mtx);
+            client->output += responses;
+            client->closed = closed;
+            requeue = client->pendingLines > 0;
+            client->scheduled = requeue;
+        }
+        client->produced.notify_all();
+        if (requeue) {
+            workers[self]->deque.push(client);
+            notifySleeper();
+        }
+        if (outstanding.fetch_sub(count) == (long long)count) {
+            lock_guard<mutex> lock(idleMtx);
+            idle.notify_all();
+        }
     }
 
-    bool removeVehicle() {
-        if (!isOccupied)
-            return false;
-        parkedVehicle.clear();
-        isOccupied = false;
-        return true;
+    void workerLoop(size_t self) {
+        for (;;) {
+            Client* client = findWork(self, false);
+            if (client == nullptr) {
+                // Announce the sleep before the last look, so a concurrent
+                // notifySleeper either sees us or its work is found here.
+                unique_lock<mutex> lock(mtx);
+                sleepers.fetch_add(1);
+                client = findWork(self, true);
+                if (client == nullptr) {
+                    wake.wait(lock, [&] { return wakeups > 0 || stopping || !injected.empty(); });
+                    if (wakeups > 0)
+                        --wakeups;
+                }
+                sleepers.fetch_sub(1);
+                if (client == nullptr && stopping && injected.empty())
+                    return;
+            }
+            if (client != nullptr)
+                run(client, self);
+        }
     }
-};
 
-//------------------------------------------------------
-// Floor Class: Each floor manages its parking spots.
-class Floor {
 public:
-    int floorNumber;
-    // Store parking spots as pointers
-    vector<ParkingSpot*> spots;
+    RequestEngine(ParkingLot& lot, int numWorkers)
+        : lot(lot), sleepers(0), wakeups(0), stopping(false), outstanding(0) {
+        for (int i = 0; i < max(1, numWorkers); ++i)
+            workers.emplace_back(new Worker());
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i]->runner = thread(&RequestEngine::workerLoop, this, i);
+    }
 
-    // Constructor
-    Floor(int floorNumber, int numSpots)
-        : floorNumber(floorNumber)
-    {
-        for (int i = 0; i < numSpots; ++i) {
-            spots.push_back(new ParkingSpot(floorNumber, i));
+    RequestEngine(const RequestEngine&) = delete;
+    RequestEngine& operator=(const RequestEngine&) = delete;
+
+    // Runs whatever was submitted, then stops the workers.
+    ~RequestEngine() {
+        waitIdle();
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
         }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker->runner.join();
+    }
+
+    // A new client; owned by the engine.
+    Client* addClient() {
+        lock_guard<mutex> lock(mtx);
+        clients.emplace_back(new Client());
+        return clients.back().get();
     }
 
-    // Destructor to delete allocated ParkingSpot pointers
-    ~Floor() {
-        for (auto* spot : spots) {
-            delete spot;
+    // Queue one command line for `client`. Blocks while the client is more
+    // than kMaxClientBacklog bytes ahead of the workers. One thread at a time
+    // per client, so lines keep their order.
+    void submit(Client* client, string_view line) {
+        bool schedule;
+        {
+            unique_lock<mutex> lock(client->mtx);
+            client->drained.wait(lock, [&] {
+                return client->pending.size() - client->pendingBegin < kMaxClientBacklog;
+            });
+            client->pending.append(line.data(), line.size());
+            client->pending.push_back('\n');
+            client->pendingLines++;
+            outstanding.fetch_add(1);
+            schedule = !client->scheduled;
+            client->scheduled = true;
+        }
+        if (schedule) {
+            lock_guard<mutex> lock(mtx);
+            injected.push_back(client);
+            wake.notify_one();
         }
-        spots.clear();
     }
 
-    // Find available spot(s) for a given vehicle.
-    // Returns a vector of spot numbers if found; empty vector if not.
-    vector<int> findAvailableSpots(const Vehicle* vehicle) {
-        int required = vehicle->getRequiredSpots();
-        vector<int> availableSpots;
-        
-        // For vehicles needing only 1 spot.
-        if (required == 1) {
-            for (auto* spot : spots) {
-                if (!spot->isOccupied) {
-                    availableSpots.push_back(spot->spotNumber);
-                    return availableSpots; // return first available spot
-                }
+    // Blocks until every line submitted so far has run.
+    void waitIdle() {
+        unique_lock<mutex> lock(idleMtx);
+        idle.wait(lock, [&] { return outstanding.load() == 0; });
+    }
+
+    // Responses produced for `client` since the last call, in submission order.
+    string takeOutput(Client* client) {
+        lock_guard<mutex> lock(client->mtx);
+        string output;
+        output.swap(client->output);
+        return output;
+    }
+
+    // No more lines will be submitted for `client`.
+    void finish(Client* client) {
+        {
+            lock_guard<mutex> lock(client->mtx);
+            client->finished = true;
+        }
+        client->produced.notify_all();
+    }
+
+    // Like takeOutput, but blocks until there is some. Returns an empty
+    // string once `client` is finished and every line it submitted has run.
+    string waitOutput(Client* client) {
+        unique_lock<mutex> lock(client->mtx);
+        client->produced.wait(lock, [&] {
+            return !client->output.empty() || (client->finished && !client->scheduled);
+        });
+        string output;
+        output.swap(client->output);
+        return output;
+    }
+};
+
+// Runs several command streams at once, one engine client per input file
+// (stdin if none), on `workers` threads. Each input's responses are written
+// to stdout as one block, in the order the inputs were given. The block being
+// written is streamed as it is produced, so the first input's responses are
+// never held back; later inputs' responses are held only until the inputs
+// before them are done.
+static int runParallelBatch(const vector<string>& paths, LotOptions options, EventSink* eventSink,
+                            int workers) {
+    vector<FILE*> inputs;
+    for (const string& path : paths) {
+        inputs.push_back(fopen(path.c_str(), "rb"));
+        if (inputs.back() == nullptr) {
+            cerr << "Cannot open " << path << endl;
+            for (FILE* in : inputs)
+                if (in != nullptr)
+                    fclose(in);
+            return 1;
+        }
+    }
+    if (inputs.empty())
+        inputs.push_back(stdin);
+    vector<unique_ptr<LineReader>> readers;
+    for (FILE* in : inputs)
+        readers.emplace_back(new LineReader(in));
+
+    // As in runBatch, the first input may start with the lot size.
+    int status = readLotSize(*readers[0], options) ? 0 : 1;
+    if (status == 0) {
+        ParkingLot parkingLot(options.numFloors, options.spotsPerFloor, options.policy, options.claimMode);
+        unique_ptr<WriteAheadLog> writeAheadLog;
+        if (!recoverLot(parkingLot, options, writeAheadLog)) {
+            status = 1;
+        } else {
+            parkingLot.setEventSink(eventSink);
+            RequestEngine engine(parkingLot, workers);
+            vector<RequestEngine::Client*> clients;
+            vector<thread> submitters;
+            for (auto& reader : readers) {
+                clients.push_back(engine.addClient());
+                submitters.emplace_back([&engine, &reader, client = clients.back()] {
+                    string_view line;
+                    while (reader->nextLine(line)) {
+                        if (!line.empty() && line.back() == '\r')
+                            line.remove_suffix(1);
+                        if (!line.empty())
+                            engine.submit(client, line);
+                    }
+                    engine.finish(client);
+                });
             }
-        } 
-        // For Truck: need 2 consecutive free spots.
-        else if (required == 2) {
-            for (size_t i = 0; i < spots.size() - 1; ++i) {
-                if (!spots[i]->isOccupied && !spots[i+1]->isOccupied) {
-                    availableSpots.push_back(spots[i]->spotNumber);
-                    availableSpots.push_back(spots[i+1]->spotNumber);
-                    return availableSpots;
+            for (auto* client : clients) {
+                for (string output; !(output = engine.waitOutput(client)).empty();) {
+                    fwrite(output.data(), 1, output.size(), stdout);
+                    fflush(stdout);
                 }
             }
+            for (auto& submitter : submitters)
+                submitter.join();
+            engine.waitIdle();
         }
-        return {}; // empty if not found
     }
+    for (FILE* in : inputs)
+        if (in != stdin)
+            fclose(in);
+    return status;
+}
 
-    // Park vehicle in specified spots. Returns true if successful.
-    bool parkVehicle(const Vehicle* vehicle, const vector<int>& spotNumbers) {
-        // Verify that the spots are still available.
-        for (int idx : spotNumbers) {
-            if (idx < 0 || idx >= (int)spots.size() || spots[idx]->isOccupied)
-                return false;
+// Worker benchmark: 16 clients, each a stream of park/find/remove lines on
+// its own plates, run one after another on a single thread (as the CLI loop
+// does) and then through RequestEngine with 1..16 workers.
+static int runWorkerBenchmark() {
+    const int numClients = 16;
+    const int vehiclesPerClient = 20000;
+    vector<vector<string>> scripts(numClients);
+    for (int c = 0; c < numClients; ++c) {
+        for (int v = 0; v < vehiclesPerClient; ++v) {
+            string plate = "G" + to_string(c) + "-" + to_string(v);
+            scripts[c].push_back("park_vehicle " + plate + " Car");
+            scripts[c].push_back("find_vehicle " + plate);
+            scripts[c].push_back("remove_vehicle " + plate);
         }
-        // Assign vehicle to the spots.
-        for (int idx : spotNumbers) {
-            spots[idx]->assignVehicle(vehicle->licensePlate);
+    }
+    long long total = (long long)numClients * vehiclesPerClient * 3;
+
+    cout << left << setw(10) << "workers" << right << setw(16) << "commands/sec" << endl;
+    {
+        ParkingLot lot(10, 1000);
+        string responses;
+        StringOutput buffer(responses);
+        ostream out(&buffer);
+        auto start = chrono::steady_clock::now();
+        for (auto& script : scripts) {
+            for (auto& line : script)
+                executeCommand(lot, parseCommand(line), out);
+            responses.clear();
         }
-        return true;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(10) << "inline" << right << setw(16) << (long long)(total / seconds) << endl;
     }
+    for (int workers : {1, 2, 4, 8, 16}) {
+        ParkingLot lot(10, 1000);
+        RequestEngine engine(lot, workers);
+        vector<RequestEngine::Client*> clients;
+        for (int c = 0; c < numClients; ++c)
+            clients.push_back(engine.addClient());
+        auto start = chrono::steady_clock::now();
+        vector<thread> submitters;
+        for (int c = 0; c < numClients; ++c) {
+            submitters.emplace_back([&, c] {
+                for (size_t i = 0; i < scripts[c].size(); ++i) {
+                    engine.submit(clients[c], scripts[c][i]);
+                    if (i % 4096 == 4095)
+                        engine.takeOutput(clients[c]);
+                }
+            });
+        }
+        for (auto& submitter : submitters)
+            submitter.join();
+        engine.waitIdle();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(10) << workers << right << setw(16) << (long long)(total / seconds) << endl;
+    }
+    return 0;
+}
 
-    // Remove vehicle from its spot(s). Returns true if vehicle was found.
-    bool removeVehicle(const string& licensePlate) {
-        bool removed = false;
-        for (auto* spot : spots) {
-            if (spot->isOccupied && spot->parkedVehicle == licensePlate) {
-                spot->removeVehicle();
-                removed = true;
-            }
+//------------------------------------------------------
+// Binary wire protocol, accepted by the server next to the text commands.
+// A request is a WireRequest header followed by the license plate bytes. The
+// response is a WireResponse header followed by `valueCount` int32 values.
+// Opcodes have the high bit set and no text command starts with such a
+// byte, so one connection may mix both forms: the server checks the first
+// byte of each message. Integers are in host byte order, which is
+// little-endian on every target this builds for.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "wire protocol assumes little-endian");
+
+enum class WireOp : uint8_t {
+    ParkVehicle = 0x81,
+    RemoveVehicle = 0x82,
+    FindVehicle = 0x83,
+    AvailableSpots = 0x84,
+    IsFull = 0x85
+};
+
+const uint8_t kWireOk = 0xFE;          // status of a query, which has no ParkingStatus
+const uint8_t kWireBadRequest = 0xFF;  // unknown opcode or vehicle type, or missing plate
+
+struct WireRequest {
+    uint8_t opcode;         // WireOp
+    uint8_t vehicleType;    // VehicleType; ParkVehicle only
+    uint16_t plateLength;   // plate bytes following the header
+    uint32_t requestId;     // echoed in the response
+};
+
+struct WireResponse {
+    uint8_t opcode;         // echoed from the request
+    uint8_t status;         // ParkingStatus, kWireOk or kWireBadRequest
+    uint16_t flags;         // kWireLogFailed
+    uint32_t requestId;
+    int32_t floorNumber;    // -1 unless parked, removed or found
+    uint32_t valueCount;    // values following: the spots; free spots per floor for
+                            // AvailableSpots; 1 (full) or 0 for IsFull
+};
+static_assert(sizeof(WireRequest) == 8 && sizeof(WireResponse) == 16, "wire headers must stay packed");
+
+// Response flag: parked/removed, but the write-ahead log has failed.
+static const uint16_t kWireLogFailed = 1;
+
+static bool isWireOpcode(char c) {
+    return (unsigned char)c & 0x80;
+}
+
+static void appendWireResponse(string& out, const WireRequest& request, uint8_t status, int floorNumber,
+                               const int* values, uint32_t valueCount, uint16_t flags = 0) {
+    WireResponse response{request.opcode, status, flags, request.requestId, floorNumber, valueCount};
+    out.append(reinterpret_cast<const char*>(&response), sizeof(response));
+    static_assert(sizeof(int) == sizeof(int32_t), "spot numbers are sent as int32");
+    out.append(reinterpret_cast<const char*>(values), valueCount * sizeof(int32_t));
+}
+
+// Runs one binary request against the lot and appends the response to `out`.
+static void executeWireRequest(ParkingLot& parkingLot, const WireRequest& request, string_view plate,
+                               string& out) {
+    bool needsPlate = request.opcode >= (uint8_t)WireOp::ParkVehicle
+                      && request.opcode <= (uint8_t)WireOp::FindVehicle;
+    if (needsPlate && plate.empty()) {
+        appendWireResponse(out, request, kWireBadRequest, -1, nullptr, 0);
+        return;
+    }
+    ParkingResult result(ParkingStatus::NotFound);
+    switch (static_cast<WireOp>(request.opcode)) {
+    case WireOp::ParkVehicle:
+        if (request.vehicleType > (uint8_t)VehicleType::Truck) {
+            appendWireResponse(out, request, kWireBadRequest, -1, nullptr, 0);
+            return;
         }
-        return removed;
+        result = parkingLot.parkVehicle(string(plate), static_cast<VehicleType>(request.vehicleType));
+        break;
+    case WireOp::RemoveVehicle:
+        result = parkingLot.removeVehicle(string(plate));
+        break;
+    case WireOp::FindVehicle:
+        result = parkingLot.findVehicle(string(plate));
+        break;
+    case WireOp::AvailableSpots: {
+        vector<int> available = parkingLot.getAvailableSpotsPerFloor();
+        appendWireResponse(out, request, kWireOk, -1, available.data(), available.size());
+        return;
+    }
+    case WireOp::IsFull: {
+        int full = parkingLot.isFull() ? 1 : 0;
+        appendWireResponse(out, request, kWireOk, -1, &full, 1);
+        return;
     }
+    default:
+        appendWireResponse(out, request, kWireBadRequest, -1, nullptr, 0);
+        return;
+    }
+    appendWireResponse(out, request, (uint8_t)result.status, result.floorNumber,
+                       result.spots.begin(), result.spots.size(), result.logFailed ? kWireLogFailed : 0);
+}
 
-    // Count available spots on the floor.
-    int availableSpotsCount() {
-        int count = 0;
-        for (auto* spot : spots) {
-            if (!spot->isOccupied)
-                count++;
+//------------------------------------------------------
+// Server mode: one ParkingLot shared by many gate terminals over a local
+// socket. Clients send CLI commands as lines and get the same response lines
+// back, or send binary WireRequests and get WireResponses. Responses come
+// back in request order. Clients may pipeline, sending many requests before
+// reading.
+// Each event loop thread has its own epoll set, accepts from the shared
+// listening socket and runs commands inline, so there is no hand-off between
+// threads on the request path.
+
+// Opens a socket for `address`: "unix:<path>" or "[<host>:]<port>", where
+// the host must be an IPv4 address and defaults to 127.0.0.1. Listening
+// sockets are bound and non-blocking; client sockets are connected and
+// blocking. Returns -1 (with errno set) on failure.
+static int openSocket(const string& address, bool listening) {
+    int fd;
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        if (listening)
+            ::unlink(path.c_str());
+        int rc = listening ? ::bind(fd, (sockaddr*)&addr, sizeof(addr))
+                           : ::connect(fd, (sockaddr*)&addr, sizeof(addr));
+        if (rc != 0) {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return -1;
+        }
+    } else {
+        size_t colon = address.rfind(':');
+        string host = (colon == string::npos) ? "127.0.0.1" : address.substr(0, colon);
+        int port = atoi(address.c_str() + (colon == string::npos ? 0 : colon + 1));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+            errno = EINVAL;
+            return -1;
+        }
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        int one = 1;
+        ::setsockopt(fd, listening ? SOL_SOCKET : IPPROTO_TCP, listening ? SO_REUSEADDR : TCP_NODELAY,
+                     &one, sizeof(one));
+        int rc = listening ? ::bind(fd, (sockaddr*)&addr, sizeof(addr))
+                           : ::connect(fd, (sockaddr*)&addr, sizeof(addr));
+        if (rc != 0) {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return -1;
         }
-        return count;
     }
+    if (listening && (::listen(fd, SOMAXCONN) != 0 || ::fcntl(fd, F_SETFL, O_NONBLOCK) != 0)) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// Longest command line accepted, and how much unsent output a connection may
+// build up before the server stops reading from it.
+const size_t kMaxLineLength = 64 * 1024;
+const size_t kMaxPendingOutput = 1 << 20;
+
+struct Connection {
+    int fd;
+    string input;           // bytes received after the last complete line
+    string output;          // responses not yet sent
+    size_t outputSent;      // prefix of `output` already sent
+    bool closing;           // close once `output` is sent (exit, oversized line)
+    uint32_t events;        // epoll events currently registered
+    StringOutput buffer;
+    ostream out;
+
+    explicit Connection(int fd)
+        : fd(fd), outputSent(0), closing(false), events(0), buffer(output), out(&buffer) {}
 };
 
-//------------------------------------------------------
-// ParkingLot Class: Manages all floors and global operations.
-class ParkingLot {
-private:
-    // Maps: licensePlate -> (floorNumber, spotNumbers)
-    unordered_map<string, pair<int, vector<int>>> vehicleLocations;
-    // Additional map to track actual Vehicle pointers (for memory cleanup)
-    unordered_map<string, Vehicle*> vehiclesMap;
+// Written to (from a signal handler) to stop every event loop.
+static int serverStopFd = -1;
+
+static void requestServerStop(int) {
+    uint64_t one = 1;
+    ssize_t ignored = ::write(serverStopFd, &one, sizeof(one));
+    (void)ignored;
+}
 
-    // Mutex for concurrency:
-    mutable std::mutex mtx;  // Protects access to vehicleLocations, vehiclesMap, and floors.
+class ServerLoop {
+    int epollFd;
+    int listenFd;
+    ParkingLot& lot;
+    unordered_map<int, unique_ptr<Connection>> connections;
 
-public:
-    // Store floors as pointers
-    vector<Floor*> floors;
+    void watch(Connection& conn, uint32_t events) {
+        if (conn.events == events)
+            return;
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = conn.fd;
+        ::epoll_ctl(epollFd, conn.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.events = events;
+    }
 
-    // Constructor
-    ParkingLot(int numFloors, int spotsPerFloor) {
-        for (int i = 0; i < numFloors; ++i) {
-            floors.push_back(new Floor(i, spotsPerFloor));
+    void close(Connection& conn) {
+        ::epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        ::close(conn.fd);
+        connections.erase(conn.fd);   // destroys conn
+    }
+
+    void acceptAll() {
+        for (;;) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;   // EAGAIN: another loop took it, or none left
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // fails harmlessly on unix sockets
+            Connection& conn = *(connections[fd] = unique_ptr<Connection>(new Connection(fd)));
+            watch(conn, EPOLLIN | EPOLLRDHUP);
         }
     }
 
-    // Destructor to delete allocated Floor pointers
-    ~ParkingLot() {
-        for (auto* floor : floors) {
-            delete floor;
+    // Runs every complete line or binary request in `conn.input`, appending
+    // the responses.
+    void runCommands(Connection& conn) {
+        size_t begin = 0;
+        while (!conn.closing && begin < conn.input.size()) {
+            if (isWireOpcode(conn.input[begin])) {
+                WireRequest request;
+                if (conn.input.size() - begin < sizeof(request))
+                    break;
+                memcpy(&request, conn.input.data() + begin, sizeof(request));
+                if (conn.input.size() - begin - sizeof(request) < request.plateLength)
+                    break;
+                string_view plate(conn.input.data() + begin + sizeof(request), request.plateLength);
+                executeWireRequest(lot, request, plate, conn.output);
+                begin += sizeof(request) + request.plateLength;
+                continue;
+            }
+            size_t newline = conn.input.find('\n', begin);
+            if (newline == string::npos)
+                break;
+            string_view line(conn.input.data() + begin, newline - begin);
+            begin = newline + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            if (line.empty())
+                continue;
+            Command command = parseCommand(line);
+            if (command.type == CommandType::Exit)
+                conn.closing = true;
+            else if (command.type == CommandType::Snapshot && (lot.getSnapshotPath().empty()
+                                                               || command.arguments != lot.getSnapshotPath()))
+                conn.out << "Clients may only write the server's --snapshot file." << '\n';
+            else
+                executeCommand(lot, command, conn.out);
+        }
+        conn.input.erase(0, begin);
+        if (conn.input.size() > kMaxLineLength && !isWireOpcode(conn.input[0])) {
+            conn.out << "Invalid command." << '\n';
+            conn.closing = true;
         }
-        floors.clear();
     }
 
-    // Park a vehicle. Returns true if parked successfully.
-    bool parkVehicle(Vehicle* vehicle) {
-        // Lock the mutex to protect shared data.
-        lock_guard<mutex> lock(mtx);
+    // Sends pending output, then picks the events to wait for: more input
+    // unless the client is not reading its responses. Returns false if the
+    // connection was closed.
+    bool flush(Connection& conn) {
+        while (conn.outputSent < conn.output.size()) {
+            ssize_t n = ::send(conn.fd, conn.output.data() + conn.outputSent,
+                               conn.output.size() - conn.outputSent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0) {
+                close(conn);
+                return false;
+            }
+            conn.outputSent += n;
+        }
+        if (conn.outputSent == conn.output.size()) {
+            conn.output.clear();
+            conn.outputSent = 0;
+            if (conn.closing) {
+                close(conn);
+                return false;
+            }
+            watch(conn, EPOLLIN | EPOLLRDHUP);
+        } else {
+            bool backlogged = conn.closing || conn.output.size() - conn.outputSent > kMaxPendingOutput;
+            watch(conn, backlogged ? EPOLLOUT : EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+        }
+        return true;
+    }
 
-        // Check if vehicle is already parked.
-        if (vehicleLocations.find(vehicle->licensePlate) != vehicleLocations.end()) {
-            cout << "Vehicle " << vehicle->licensePlate << " is already parked." << endl;
-            return false;
+    void onReadable(Connection& conn) {
+        char chunk[64 * 1024];
+        bool peerClosed = false;
+        for (;;) {
+            ssize_t n = ::recv(conn.fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n <= 0) {
+                peerClosed = true;
+                break;
+            }
+            conn.input.append(chunk, n);
+            if ((size_t)n < sizeof(chunk))
+                break;
         }
+        // Peer closed (or failed): answer what it already sent, then close.
+        runCommands(conn);
+        if (peerClosed)
+            conn.closing = true;
+        flush(conn);
+    }
 
-        // Iterate floors to find available spot(s)
-        for (auto* floor : floors) {
-            vector<int> availableSpots = floor->findAvailableSpots(vehicle);
-            if (!availableSpots.empty()) {
-                if (floor->parkVehicle(vehicle, availableSpots)) {
-                    // Save location: (floorNumber, spotNumbers)
-                    vehicleLocations[vehicle->licensePlate] = {floor->floorNumber, availableSpots};
-                    // Also store the Vehicle pointer for later cleanup
-                    vehiclesMap[vehicle->licensePlate] = vehicle;
-
-                    cout << "Parked " << vehicle->licensePlate << " on floor " 
-                         << floor->floorNumber << " at spot(s): ";
-                    for (int s : availableSpots)
-                        cout << s << " ";
-                    cout << endl;
-                    return true;
+public:
+    ServerLoop(int listenFd, ParkingLot& lot)
+        : epollFd(::epoll_create1(EPOLL_CLOEXEC)), listenFd(listenFd), lot(lot) {}
+
+    ~ServerLoop() {
+        for (auto& entry : connections)
+            ::close(entry.first);
+        ::close(epollFd);
+    }
+
+    // Serves until serverStopFd is signalled.
+    void run() {
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = listenFd;
+        ::epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = serverStopFd;
+        ::epoll_ctl(epollFd, EPOLL_CTL_ADD, serverStopFd, &ev);
+
+        epoll_event events[64];
+        for (;;) {
+            int n = ::epoll_wait(epollFd, events, 64, -1);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return;
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == serverStopFd)
+                    return;
+                if (fd == listenFd) {
+                    acceptAll();
+                    continue;
                 }
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+                Connection& conn = *it->second;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    onReadable(conn);
+                else if (events[i].events & EPOLLOUT)
+                    flush(conn);
             }
         }
+    }
+};
 
-        cout << "Parking Lot Full or no suitable spot available for "
-             << vehicle->licensePlate << endl;
-        return false;
+// Serves `address` with `threads` event loops until SIGINT/SIGTERM.
+static int runServer(const string& address, const LotOptions& options, int threads, EventSink* eventSink) {
+    if (options.numFloors < 0 || options.spotsPerFloor < 0) {
+        cerr << "Server mode needs --floors and --spots (or --snapshot)" << endl;
+        return 1;
     }
+    ParkingLot parkingLot(options.numFloors, options.spotsPerFloor, options.policy, options.claimMode);
+    unique_ptr<WriteAheadLog> writeAheadLog;
+    if (!recoverLot(parkingLot, options, writeAheadLog))
+        return 1;
+    parkingLot.setEventSink(eventSink);
 
-    // Remove a vehicle based on license plate. Returns true if removed.
-    bool removeVehicle(const string& licensePlate) {
-        // Lock the mutex to protect shared data.
-        lock_guard<mutex> lock(mtx);
+    int listenFd = openSocket(address, true);
+    if (listenFd < 0) {
+        cerr << "Cannot listen on " << address << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    serverStopFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct sigaction action = {};
+    action.sa_handler = requestServerStop;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
 
-        auto it = vehicleLocations.find(licensePlate);
-        if (it == vehicleLocations.end()) {
-            cout << "Vehicle " << licensePlate << " not found." << endl;
-            return false;
+    cout << "Listening on " << address << " with " << max(1, threads) << " event loop(s)" << endl;
+    vector<thread> loops;
+    for (int t = 0; t < max(1, threads); ++t)
+        loops.emplace_back([&] { ServerLoop(listenFd, parkingLot).run(); });
+    for (auto& loop : loops)
+        loop.join();
+
+    ::close(listenFd);
+    ::close(serverStopFd);
+    if (address.compare(0, 5, "unix:") == 0)
+        ::unlink(address.c_str() + 5);
+    cout << "Server stopped" << endl;
+    return 0;
+}
+
+//------------------------------------------------------
+// Load client: `connections` threads each open a connection to a server and
+// send `requests` requests in pipelined batches of `pipeline`, waiting for
+// the whole batch of responses before sending the next. Each vehicle goes
+// through park, find and remove, as text commands or, with `binary`, as
+// WireRequests.
+struct LoadResult {
+    long long requests = 0;
+    double seconds = 0;
+    LatencySamples batches;   // round-trip time of each pipelined batch
+};
+
+// Appends the request for step `sent` of client `id` to `batch`.
+static void appendLoadRequest(string& batch, int id, long long sent, bool binary) {
+    string plate = "L" + to_string(id) + "-" + to_string(sent / 3);
+    if (binary) {
+        static const WireOp ops[] = { WireOp::ParkVehicle, WireOp::FindVehicle, WireOp::RemoveVehicle };
+        WireRequest request{(uint8_t)ops[sent % 3], (uint8_t)VehicleType::Car, (uint16_t)plate.size(),
+                            (uint32_t)sent};
+        batch.append(reinterpret_cast<const char*>(&request), sizeof(request));
+        batch += plate;
+        return;
+    }
+    static const char* const verbs[] = { "park_vehicle ", "find_vehicle ", "remove_vehicle " };
+    batch += verbs[sent % 3];
+    batch += plate;
+    batch += (sent % 3 == 0) ? " Car\n" : "\n";
+}
+
+// Consumes the complete responses at the front of `received`; returns how many.
+static int takeLoadResponses(string& received, bool binary) {
+    int responses = 0;
+    size_t begin = 0;
+    if (binary) {
+        WireResponse response;
+        while (received.size() - begin >= sizeof(response)) {
+            memcpy(&response, received.data() + begin, sizeof(response));
+            size_t frame = sizeof(response) + response.valueCount * sizeof(int32_t);
+            if (received.size() - begin < frame)
+                break;
+            begin += frame;
+            ++responses;
         }
-        int floorNumber = it->second.first;
-        // Remove from floor.
-        if (floors[floorNumber]->removeVehicle(licensePlate)) {
-            vehicleLocations.erase(it);
-            // Also delete the Vehicle pointer from vehiclesMap
-            auto vt = vehiclesMap.find(licensePlate);
-            if (vt != vehiclesMap.end()) {
-                delete vt->second;       // Free the memory for this Vehicle
-                vehiclesMap.erase(vt);
-            }
-            cout << "Vehicle " << licensePlate << " removed from floor " << floorNumber << endl;
-            return true;
+    } else {
+        for (size_t newline; (newline = received.find('\n', begin)) != string::npos; begin = newline + 1)
+            ++responses;
+    }
+    received.erase(0, begin);
+    return responses;
+}
+
+static bool measureLoad(const string& address, int connections, long long requests, int pipeline,
+                        bool binary, LoadResult& result) {
+    connections = max(1, connections);
+    pipeline = max(1, pipeline);
+    vector<LatencySamples> samples(connections);
+    vector<long long> completed(connections, 0);
+    vector<string> errors(connections);   // why each failed client stopped; empty if it did not
+    atomic<int> ready(0);
+
+    auto client = [&](int id) {
+        int fd = openSocket(address, false);
+        if (fd < 0)
+            errors[id] = strerror(errno);
+        ready++;
+        if (fd < 0)
+            return;
+        while (ready.load() < connections)
+            this_thread::yield();
+        string batch, received;
+        vector<char> chunk(64 * 1024);
+        for (long long sent = 0; sent < requests;) {
+            batch.clear();
+            int count = 0;
+            for (; count < pipeline && sent < requests; ++count, ++sent)
+                appendLoadRequest(batch, id, sent, binary);
+            auto start = chrono::steady_clock::now();
+            ssize_t n = ::send(fd, batch.data(), batch.size(), MSG_NOSIGNAL);
+            if (n != (ssize_t)batch.size()) {
+                errors[id] = n < 0 ? strerror(errno) : "short send";
+                break;
+            }
+            for (int responses = 0; n > 0 && responses < count;) {
+                n = ::recv(fd, chunk.data(), chunk.size(), 0);
+                if (n > 0) {
+                    received.append(chunk.data(), n);
+                    responses += takeLoadResponses(received, binary);
+                }
+            }
+            if (n <= 0) {
+                errors[id] = n < 0 ? strerror(errno) : "connection closed by the server";
+                break;
+            }
+            samples[id].add(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count());
+            completed[id] += count;
         }
+        ::close(fd);
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int c = 0; c < connections; ++c)
+        pool.emplace_back(client, c);
+    for (auto& th : pool)
+        th.join();
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int failures = 0;
+    const string* firstError = nullptr;
+    for (const string& error : errors) {
+        if (error.empty())
+            continue;
+        if (failures++ == 0)
+            firstError = &error;
+    }
+    if (failures > 0) {
+        cerr << failures << " connection(s) to " << address << " failed: " << *firstError << endl;
         return false;
     }
+    for (int c = 0; c < connections; ++c) {
+        result.batches.append(samples[c]);
+        result.requests += completed[c];
+    }
+    return true;
+}
 
-    // Returns a vector of available spots count per floor.
-    vector<int> getAvailableSpotsPerFloor() {
-        // Lock the mutex to protect shared data.
-        lock_guard<mutex> lock(mtx);
+static void printLoadHeader() {
+    cout << left << setw(9) << "protocol" << setw(13) << "connections" << setw(10) << "pipeline" << right
+         << setw(12) << "requests" << setw(14) << "requests/sec" << setw(14) << "batch p50 ns"
+         << setw(14) << "batch p99 ns" << endl;
+}
 
-        vector<int> available;
-        for (auto* floor : floors) {
-            available.push_back(floor->availableSpotsCount());
-        }
-        return available;
+static void printLoadRow(bool binary, int connections, int pipeline, LoadResult& result) {
+    cout << left << setw(9) << (binary ? "binary" : "text") << setw(13) << connections << setw(10) << pipeline
+         << right << setw(12) << result.requests << setw(14) << (long long)(result.requests / result.seconds)
+         << setw(14) << result.batches.percentile(0.50) << setw(14) << result.batches.percentile(0.99) << endl;
+}
+
+// Reports requests/sec and the round-trip latency of a batch against a
+// running server.
+static int runLoadTest(const string& address, int connections, long long requests, int pipeline, bool binary) {
+    LoadResult result;
+    if (!measureLoad(address, connections, requests, pipeline, binary, result))
+        return 1;
+    printLoadHeader();
+    printLoadRow(binary, max(1, connections), max(1, pipeline), result);
+    return 0;
+}
+
+// Text vs binary protocol end to end: starts a server with one event loop on
+// a unix socket in the working directory and drives the same park/find/remove
+// load through it in both forms.
+static int runWireBenchmark() {
+    const string address = "unix:parkinglot-bench.sock";
+    ParkingLot parkingLot(10, 10000);
+    int listenFd = openSocket(address, true);
+    if (listenFd < 0) {
+        cerr << "Cannot listen on " << address << ": " << strerror(errno) << endl;
+        return 1;
     }
+    serverStopFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    thread loop([&] { ServerLoop(listenFd, parkingLot).run(); });
 
-    // Checks if parking lot is full.
-    bool isFull() {
-        // Lock the mutex to protect shared data.
-        lock_guard<mutex> lock(mtx);
+    const long long requests = 60000;
+    bool ok = true;
+    printLoadHeader();
+    for (int connections : {1, 4})
+        for (int pipeline : {1, 32})
+            for (bool binary : {false, true}) {
+                LoadResult result;
+                ok = ok && measureLoad(address, connections, requests, pipeline, binary, result);
+                if (ok)
+                    printLoadRow(binary, connections, pipeline, result);
+            }
 
-        for (auto* floor : floors) {
-            if (floor->availableSpotsCount() > 0)
-                return false;
+    requestServerStop(0);
+    loop.join();
+    ::close(listenFd);
+    ::close(serverStopFd);
+    ::unlink(address.c_str() + 5);
+    return ok ? 0 : 1;
+}
+
+// Pipelined clients that send everything and half-close before the server
+// first reads, so the last bytes and the end of input arrive in one read
+// pass. Batches of 64-byte find_vehicle lines straddle the server's 64 KiB
+// read size; each client must get one response per line, then EOF.
+static bool checkServer() {
+    const string address = "unix:parkinglot-check.sock";
+    const int lineCounts[] = {1000, 1024, 1025, 2048};
+    ParkingLot parkingLot(1, 16);
+    int listenFd = openSocket(address, true);
+    if (listenFd < 0) {
+        cerr << "Cannot listen on " << address << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    vector<int> clients;
+    bool passed = true;
+    for (int lines : lineCounts) {
+        string batch;
+        for (int i = 0; i < lines; ++i) {
+            string plate = "H" + to_string(i);
+            batch += "find_vehicle " + plate + string(50 - plate.size(), 'x') + "\n";   // 64 bytes
         }
-        return true;
+        int fd = openSocket(address, false);
+        passed = passed && fd >= 0
+                 && ::send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) == (ssize_t)batch.size()
+                 && ::shutdown(fd, SHUT_WR) == 0;
+        clients.push_back(fd);
     }
 
-    // Finds the vehicle location given a license plate.
-    void findVehicle(const string& licensePlate) {
-        // Lock the mutex to protect shared data.
-        lock_guard<mutex> lock(mtx);
+    serverStopFd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    thread loop([&] { ServerLoop(listenFd, parkingLot).run(); });
+    string failures;
+    for (size_t c = 0; c < clients.size(); ++c) {
+        int responses = 0;
+        char chunk[4096];
+        ssize_t n;
+        while (clients[c] >= 0 && (n = ::recv(clients[c], chunk, sizeof(chunk), 0)) > 0)
+            responses += count(chunk, chunk + n, '\n');
+        if (responses != lineCounts[c])
+            failures += " " + to_string(responses) + "/" + to_string(lineCounts[c]);
+        if (clients[c] >= 0)
+            ::close(clients[c]);
+    }
+    requestServerStop(0);
+    loop.join();
+    ::close(listenFd);
+    ::close(serverStopFd);
+    ::unlink(address.c_str() + 5);
 
-        auto it = vehicleLocations.find(licensePlate);
-        if (it != vehicleLocations.end()) {
-            auto& location = it->second; // (floorNumber, vector<int> of spots)
-            cout << "Vehicle " << licensePlate << " is parked on floor " 
-                 << location.first << " at spot(s): ";
-            for (int s : location.second)
-                cout << s << " ";
-            cout << endl;
+    passed = passed && failures.empty();
+    cout << "Server half-close (" << clients.size() << " pipelined clients): "
+         << (passed ? "ok" : "FAILED, responses" + failures) << endl;
+    return passed;
+}
+
+// Main function with a simple command terminal interface.
+//   --stress             run the multi-threaded stress test and exit
+//   --event-log <path>   append every park/remove/find event to <path>
+//   --bench <name>       run a benchmark and exit:
+//                          core   latency/throughput of every ParkingLot operation
+//                          alloc  heap Vehicle vs the park/remove cycle
+//                          policy allocation policies: search cost vs fragmentation
+//                          wal    throughput/latency under each fsync policy
+//                          claims floor lock vs atomic bitmap claims by thread count
+//                          reads  lock-free lookups by reader count, beside a writer
+//                          workers inline command loop vs the work-stealing engine
+//                          shards shared lot vs one thread-owned shard per gate
+//                          wire   text vs binary protocol through a local server
+//   --floors <n> --spots <n>
+//                        lot size (otherwise prompted for interactively)
+//   --policy first|next|best
+//                        spot allocation policy (default first)
+//   --claims lock|cas    claim spots under the floor lock (default) or by CAS
+//                        on the occupancy bitmap (first/next policies only)
+//   --snapshot <path>    start from this snapshot if it exists (it also sets
+//                        the lot size)
+//   --wal <path> [--fsync always|interval|never] [--fsync-interval <ms>]
+//                        recover the lot from a write-ahead log, then log every
+//                        change to it (default: fsync every 10 ms)
+//   --replay <trace> [--threads <n>] [--speed <x>]
+//                        replay a trace file and report throughput/latency
+//   --gen-trace <path> [--arrivals <n>] [--rate <per sec>] [--dwell <sec>]
+//                      [--find-ratio <p>] [--seed <n>]
+//                        write a synthetic Poisson-arrival trace
+//   --batch [file...] [--workers <n>]
+//                        run commands from file (default stdin) without prompts,
+//                        with buffered I/O; with several files or --workers, run
+//                        each file as one client of a work-stealing pool of <n>
+//                        workers (default 1) and print each file's responses in turn
+//   --listen unix:<path>|[<host>:]<port> [--threads <n>]
+//                        serve the CLI commands over a socket with <n> epoll
+//                        event loops (default 4) until SIGINT/SIGTERM
+//   --load <address> [--connections <n>] [--requests <n>] [--pipeline <n>] [--binary]
+//                        load client for --listen: requests/sec and latency,
+//                        sending text commands or binary WireRequests
+int main(int argc, char* argv[]) {
+    string eventLogPath;
+    LotOptions lotOptions;
+    string replayPath, genTracePath;
+    bool batch = false;
+    vector<string> batchPaths;
+    int workers = 0;
+    int threads = 4;
+    double speed = 0;
+    long long arrivals = 100000;
+    double rate = 50, dwell = 3600, findRatio = 0;
+    uint32_t seed = 1;
+    string listenAddress, loadAddress;
+    int connections = 4, pipeline = 1;
+    bool binary = false;
+    long long requests = 100000;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--floors" && hasValue) {
+            lotOptions.numFloors = atoi(argv[++i]);
+            if (lotOptions.numFloors <= 0) {
+                cerr << "--floors must be greater than 0" << endl;
+                return 1;
+            }
+        } else if (arg == "--spots" && hasValue) {
+            lotOptions.spotsPerFloor = atoi(argv[++i]);
+            if (lotOptions.spotsPerFloor <= 0) {
+                cerr << "--spots must be greater than 0" << endl;
+                return 1;
+            }
+        } else if (arg == "--policy" && hasValue) {
+            if (!parseAllocationPolicy(argv[++i], lotOptions.policy)) {
+                cerr << "Unknown allocation policy: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--claims" && hasValue) {
+            if (!parseClaimMode(argv[++i], lotOptions.claimMode)) {
+                cerr << "Unknown claim mode: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--snapshot" && hasValue) {
+            lotOptions.snapshotPath = argv[++i];
+        } else if (arg == "--wal" && hasValue) {
+            lotOptions.walPath = argv[++i];
+        } else if (arg == "--fsync" && hasValue) {
+            if (!parseFsyncPolicy(argv[++i], lotOptions.fsyncPolicy)) {
+                cerr << "Unknown fsync policy: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--fsync-interval" && hasValue) {
+            // The flusher waits this long between syncs; 0 would make it spin.
+            lotOptions.fsyncIntervalMs = atoi(argv[++i]);
+            if (lotOptions.fsyncIntervalMs <= 0) {
+                cerr << "--fsync-interval must be greater than 0" << endl;
+                return 1;
+            }
+        } else if (arg == "--replay" && hasValue) {
+            replayPath = argv[++i];
+        } else if (arg == "--threads" && hasValue) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--speed" && hasValue) {
+            speed = atof(argv[++i]);
+        } else if (arg == "--gen-trace" && hasValue) {
+            genTracePath = argv[++i];
+        } else if (arg == "--arrivals" && hasValue) {
+            arrivals = atoll(argv[++i]);
+        } else if (arg == "--rate" && hasValue) {
+            rate = atof(argv[++i]);
+        } else if (arg == "--dwell" && hasValue) {
+            dwell = atof(argv[++i]);
+        } else if (arg == "--find-ratio" && hasValue) {
+            findRatio = atof(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            seed = (uint32_t)atoll(argv[++i]);
+        } else if (arg == "--listen" && hasValue) {
+            listenAddress = argv[++i];
+        } else if (arg == "--load" && hasValue) {
+            loadAddress = argv[++i];
+        } else if (arg == "--connections" && hasValue) {
+            connections = atoi(argv[++i]);
+        } else if (arg == "--requests" && hasValue) {
+            requests = atoll(argv[++i]);
+        } else if (arg == "--pipeline" && hasValue) {
+            pipeline = atoi(argv[++i]);
+        } else if (arg == "--binary") {
+            binary = true;
+        } else if (arg == "--batch") {
+            batch = true;
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+                batchPaths.push_back(argv[++i]);
+        } else if (arg == "--workers" && hasValue) {
+            workers = atoi(argv[++i]);
+        } else if (arg == "--stress") {
+            return runStressTest();
+        } else if (arg == "--bench" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name == "core")
+                return runCoreBenchmark();
+            if (name == "alloc")
+                return runAllocBenchmark();
+            if (name == "policy")
+                return runPolicyBenchmark();
+            if (name == "wal")
+                return runWalBenchmark();
+            if (name == "claims")
+                return runClaimBenchmark();
+            if (name == "reads")
+                return runReadBenchmark();
+            if (name == "workers")
+                return runWorkerBenchmark();
+            if (name == "shards")
+                return runShardBenchmark();
+            if (name == "wire")
+                return runWireBenchmark();
+            cerr << "Unknown benchmark: " << name << endl;
+            return 1;
+        } else if (arg == "--event-log" && i + 1 < argc) {
+            eventLogPath = argv[++i];
         } else {
-            cout << "Vehicle " << licensePlate << " not found." << endl;
+            cerr << "Unknown option: " << arg << endl;
+            return 1;
         }
     }
-};
 
-// Main function with a simple command terminal interface.
-int main() {
-
-    cout << "Enter the number of floors: ";
-    int numFloors;
-    cin>>numFloors;
-    cout << "Enter the number of spots per floor: ";
-    int spotsPerFloor;
-    cin>>spotsPerFloor;   
+    if (!genTracePath.empty()) {
+        // exponential_distribution needs a positive rate.
+        if (!(rate > 0) || !(dwell > 0)) {
+            cerr << "--rate and --dwell must be greater than 0" << endl;
+            return 1;
+        }
+        if (arrivals < 0) {
+            cerr << "--arrivals must not be negative" << endl;
+            return 1;
+        }
+        return generateTrace(genTracePath, arrivals, rate, dwell, findRatio, seed);
+    }
+    if (!replayPath.empty())
+        return runReplay(replayPath, lotOptions, threads, speed);
+    if (!loadAddress.empty())
+        return runLoadTest(loadAddress, connections, requests, pipeline, binary);
+
+    // A snapshot fixes the lot size.
+    if (!lotOptions.snapshotPath.empty() && access(lotOptions.snapshotPath.c_str(), F_OK) == 0) {
+        SnapshotHeader header;
+        if (!SnapshotFile::readHeader(lotOptions.snapshotPath, header)) {
+            cerr << lotOptions.snapshotPath << " is not a valid snapshot" << endl;
+            return 1;
+        }
+        int numFloors = header.numFloors;
+        int spotsPerFloor = header.spotsPerFloor;
+        if ((lotOptions.numFloors >= 0 && lotOptions.numFloors != numFloors)
+            || (lotOptions.spotsPerFloor >= 0 && lotOptions.spotsPerFloor != spotsPerFloor)) {
+            cerr << "Snapshot " << lotOptions.snapshotPath << " is for " << numFloors << " floor(s) of "
+                 << spotsPerFloor << " spots" << endl;
+            return 1;
+        }
+        lotOptions.numFloors = numFloors;
+        lotOptions.spotsPerFloor = spotsPerFloor;
+    }
+
+    // Events are written by a background thread, off the parking path.
+    ofstream eventLog;
+    unique_ptr<RingBufferEventSink> eventSink;
+    if (!eventLogPath.empty()) {
+        eventLog.open(eventLogPath, ios::app);
+        if (!eventLog) {
+            cerr << "Cannot open event log " << eventLogPath << endl;
+            return 1;
+        }
+        eventSink.reset(new RingBufferEventSink(eventLog));
+    }
+
+    if (!listenAddress.empty())
+        return runServer(listenAddress, lotOptions, threads, eventSink.get());
+
+    if (batch && (workers > 0 || batchPaths.size() > 1))
+        return runParallelBatch(batchPaths, lotOptions, eventSink.get(), workers);
+    if (batch) {
+        const string batchPath = batchPaths.empty() ? string() : batchPaths[0];
+        FILE* in = batchPath.empty() ? stdin : fopen(batchPath.c_str(), "rb");
+        if (in == nullptr) {
+            cerr << "Cannot open " << batchPath << endl;
+            return 1;
+        }
+        int status = runBatch(in, lotOptions, eventSink.get());
+        if (in != stdin)
+            fclose(in);
+        return status;
+    }
+
+    if (lotOptions.numFloors < 0) {
+        cout << "Enter the number of floors: ";
+        if (!(cin>>lotOptions.numFloors) || lotOptions.numFloors <= 0) {
+            cerr << "The number of floors must be a positive integer" << endl;
+            return 1;
+        }
+    }
+    if (lotOptions.spotsPerFloor < 0) {
+        cout << "Enter the number of spots per floor: ";
+        if (!(cin>>lotOptions.spotsPerFloor) || lotOptions.spotsPerFloor <= 0) {
+            cerr << "The number of spots per floor must be a positive integer" << endl;
+            return 1;
+        }
+    }
     // Create ParkingLot on the stack (it manages Floor pointers internally)
-    ParkingLot parkingLot(numFloors, spotsPerFloor);
+    ParkingLot parkingLot(lotOptions.numFloors, lotOptions.spotsPerFloor, lotOptions.policy,
+                          lotOptions.claimMode);
+    unique_ptr<WriteAheadLog> writeAheadLog;
+    if (!recoverLot(parkingLot, lotOptions, writeAheadLog))
+        return 1;
+    parkingLot.setEventSink(eventSink.get());
 
     cout << "Parking Lot System" << endl;
     cout << "Commands:" << endl;
@@ -308,6 +6164,10 @@ int main() {
     cout << "  available_spots" << endl;
     cout << "  is_full" << endl;
     cout << "  find_vehicle <license_plate>" << endl;
+    cout << "  park_vehicles <license_plate> <vehicle_type> [...]" << endl;
+    cout << "  remove_vehicles <license_plate> [...]" << endl;
+    cout << "  snapshot <path>" << endl;
+    cout << "  stats" << endl;
     cout << "  exit" << endl;
 
     string input;
@@ -321,71 +6181,11 @@ int main() {
             continue;
         }
 
-        istringstream iss(input);
-        string command;
-        iss >> command;
-
-        if (command == "park_vehicle") {
-            string license, typeStr;
-            iss >> license >> typeStr;
-            if (license.empty() || typeStr.empty()) {
-                cout << "Invalid input. Usage: park_vehicle <license_plate> <vehicle_type>" << endl;
-                continue;
-            }
-
-            VehicleType type;
-            if (typeStr == "Bike")
-                type = VehicleType::Bike;
-            else if (typeStr == "Car")
-                type = VehicleType::Car;
-            else if (typeStr == "Truck")
-                type = VehicleType::Truck;
-            else {
-                cout << "Unknown vehicle type." << endl;
-                continue;
-            }
-
-            Vehicle* vehicle = new Vehicle(license, type);
-            // Attempt to park in the lot
-            parkingLot.parkVehicle(vehicle);
-
-        }
-        else if (command == "remove_vehicle") {
-            string license;
-            iss >> license;
-            if (license.empty()) {
-                cout << "Usage: remove_vehicle <license_plate>" << endl;
-                continue;
-            }
-            parkingLot.removeVehicle(license);
-        }
-        else if (command == "available_spots") {
-            vector<int> available = parkingLot.getAvailableSpotsPerFloor();
-            for (size_t i = 0; i < available.size(); ++i) {
-                cout << "Floor " << i << ": " << available[i] << " spots available." << endl;
-            }
-        }
-        else if (command == "is_full") {
-            if (parkingLot.isFull())
-                cout << "Parking lot is full." << endl;
-            else
-                cout << "Parking lot has available spots." << endl;
-        }
-        else if (command == "find_vehicle") {
-            string license;
-            iss >> license;
-            if (license.empty()) {
-                cout << "Usage: find_vehicle <license_plate>" << endl;
-                continue;
-            }
-            parkingLot.findVehicle(license);
-        }
-        else if (command == "exit") {
+        Command command = parseCommand(input);
+        if (command.type == CommandType::Exit) {
             break;
         }
-        else {
-            cout << "Invalid command." << endl;
-        }
+        executeCommand(parkingLot, command, cout);
     }
     return 0;
 }